@@ -54,8 +54,17 @@ string base64_encode(string_view in) {
 		out.push_back(base64[(uin[i + 2] << 0 & 63)                    ]);
 	}
 
-	while (i++ < in.size())
+	if (i + 1 == in.size()) {
+		out.push_back(base64[                         (uin[i + 0] >> 2)]);
+		out.push_back(base64[(uin[i + 0] << 4 & 63)                    ]);
+		out.push_back('=');
+		out.push_back('=');
+	} else if (i + 2 == in.size()) {
+		out.push_back(base64[                         (uin[i + 0] >> 2)]);
+		out.push_back(base64[(uin[i + 0] << 4 & 63) | (uin[i + 1] >> 4)]);
+		out.push_back(base64[(uin[i + 1] << 2 & 63)                    ]);
 		out.push_back('=');
+	}
 
 	return out;
 }
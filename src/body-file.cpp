@@ -0,0 +1,197 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "body-file.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "base64.hpp"
+
+using namespace std;
+
+namespace Mimesis {
+
+// Base64 encodes 57 bytes into a line of 76 characters.
+static const size_t line_bytes = 57;
+static const size_t chunk_bytes = 1024 * line_bytes;
+
+BodyFile::BodyFile(const string &filename, bool base64): BodyFile(::open(filename.c_str(), O_RDONLY | O_CLOEXEC), base64) {}
+
+// Takes ownership of the file descriptor.
+BodyFile::BodyFile(int fd, bool base64): fd(fd), size(0), base64(base64) {
+	if (fd == -1)
+		throw runtime_error("could not open attachment");
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		throw runtime_error("attachment is not a regular file");
+	}
+
+	size = st.st_size;
+}
+
+BodyFile::~BodyFile() {
+	close(fd);
+}
+
+bool BodyFile::is_base64() const {
+	return base64;
+}
+
+size_t BodyFile::get_size() const {
+	return size;
+}
+
+size_t BodyFile::get_saved_size(const string &ending) const {
+	if (!base64)
+		return size;
+
+	size_t lines = (size + line_bytes - 1) / line_bytes;
+	return (size + 2) / 3 * 4 + lines * ending.size();
+}
+
+static void read_fully(int fd, char *buf, size_t len, size_t offset) {
+	while (len) {
+		ssize_t result = pread(fd, buf, len, offset);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			throw runtime_error("could not read attachment");
+		buf += result;
+		len -= result;
+		offset += result;
+	}
+}
+
+string BodyFile::read() const {
+	string data(size, 0);
+	read_fully(fd, &data[0], size, 0);
+	return data;
+}
+
+void BodyFile::read_saved(const string &ending, const function<void(const char *data, size_t len)> &chunk) const {
+	string buf(min(size, chunk_bytes), 0);
+	string encoded;
+
+	for (size_t offset = 0; offset < size; offset += buf.size()) {
+		if (size - offset < buf.size())
+			buf.resize(size - offset);
+
+		read_fully(fd, &buf[0], buf.size(), offset);
+
+		if (!base64) {
+			chunk(buf.data(), buf.size());
+			continue;
+		}
+
+		auto lines = base64_encode(buf);
+		encoded.clear();
+		for (size_t i = 0; i < lines.size(); i += 76) {
+			encoded.append(lines, i, 76);
+			encoded.append(ending);
+		}
+
+		chunk(encoded.data(), encoded.size());
+	}
+}
+
+void write_fully(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t result = write(fd, buf, len);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0)
+			throw runtime_error("could not write message");
+		buf += result;
+		len -= result;
+	}
+}
+
+void BodyFile::send(int out, const string &ending) const {
+#ifdef __linux__
+	// Let the kernel copy the data if it doesn't need encoding.
+	if (!base64) {
+		off_t offset = 0;
+
+		while (static_cast<size_t>(offset) < size) {
+			ssize_t result = sendfile(out, fd, &offset, size - offset);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result < 0 && (errno == EINVAL || errno == ENOSYS) && offset == 0)
+				break;
+			if (result <= 0)
+				throw runtime_error("could not write message");
+		}
+
+		if (static_cast<size_t>(offset) == size)
+			return;
+	}
+#endif
+
+	read_saved(ending, [&](const char *data, size_t len) {
+		write_fully(out, data, len);
+	});
+}
+
+int create_temporary_file(const string &directory) {
+#ifdef MFD_CLOEXEC
+	if (directory.empty()) {
+		int fd = memfd_create("mimesis-body", MFD_CLOEXEC);
+		if (fd != -1)
+			return fd;
+	}
+#endif
+
+	string dir = directory;
+	if (dir.empty()) {
+		auto tmpdir = getenv("TMPDIR");
+		dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+	}
+
+#ifdef O_TMPFILE
+	int fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd != -1)
+		return fd;
+#endif
+
+	string name = dir + "/mimesis-XXXXXX";
+	int tmp = mkstemp(&name[0]);
+	if (tmp == -1)
+		throw runtime_error("could not create temporary file");
+
+	unlink(name.c_str());
+	fcntl(tmp, F_SETFD, FD_CLOEXEC);
+	return tmp;
+}
+
+bool operator==(const BodyFile &lhs, const BodyFile &rhs) {
+	return &lhs == &rhs || (lhs.is_base64() == rhs.is_base64() && lhs.get_size() == rhs.get_size() && lhs.read() == rhs.read());
+}
+
+}
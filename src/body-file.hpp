@@ -0,0 +1,61 @@
+#pragma once
+
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace Mimesis {
+
+/* The body of a part, stored in a file instead of in memory.
+ * If base64 is set, the file contains the decoded body, which is encoded
+ * while the part is being saved. Otherwise it is saved as is.
+ */
+class BodyFile {
+	int fd;
+	size_t size;
+	bool base64;
+
+	public:
+	BodyFile(const std::string &filename, bool base64);
+	BodyFile(int fd, bool base64);
+	~BodyFile();
+
+	BodyFile(const BodyFile &) = delete;
+	BodyFile &operator=(const BodyFile &) = delete;
+
+	bool is_base64() const;
+	size_t get_size() const;
+	size_t get_saved_size(const std::string &ending) const;
+
+	std::string read() const;
+	void read_saved(const std::string &ending, const std::function<void(const char *data, size_t len)> &chunk) const;
+	void send(int out, const std::string &ending) const;
+};
+
+bool operator==(const BodyFile &lhs, const BodyFile &rhs);
+
+/* Creates an anonymous file to hold a body, and returns its file descriptor.
+ * If no directory is given, it is created in memory if possible,
+ * otherwise in $TMPDIR or /tmp.
+ */
+int create_temporary_file(const std::string &directory);
+void write_fully(int fd, const char *buf, size_t len);
+
+}
@@ -18,30 +18,77 @@
 #include "charset.hpp"
 
 #include <iconv.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
-struct iconv_state {
-	iconv_t cd;
+// Opening a conversion descriptor is expensive, and takes a global lock in
+// some C libraries, so each thread keeps the descriptors it has used most
+// recently. The names come from untrusted input, so the number is limited.
+namespace {
 
-	iconv_state(const char *tocode, const char *fromcode) {
-		cd = iconv_open(tocode, fromcode);
-		if (cd == (iconv_t)-1)
-			throw runtime_error("Unsupported character set");
+struct iconv_cache {
+	static const size_t max_size = 8;
+
+	// Most recently used first
+	vector<pair<string, iconv_t>> descriptors;
+
+	~iconv_cache() {
+		for (auto &descriptor: descriptors)
+			iconv_close(descriptor.second);
 	}
 
-	~iconv_state() {
-		iconv_close(cd);
+	static string normalize(const string &charset) {
+		size_t start = 0;
+		size_t end = charset.size();
+		while (start < end && isspace(static_cast<unsigned char>(charset[start])))
+			start++;
+		while (end > start && isspace(static_cast<unsigned char>(charset[end - 1])))
+			end--;
+
+		string name;
+		for (size_t i = start; i < end; i++)
+			name.push_back(tolower(static_cast<unsigned char>(charset[i])));
+		return name;
 	}
 
-	size_t convert(char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) {
-		return ::iconv(cd, inbuf, inbytesleft, outbuf, outbytesleft);
+	iconv_t get(const string &charset) {
+		auto name = normalize(charset);
+
+		for (auto it = descriptors.begin(); it != descriptors.end(); ++it) {
+			if (it->first == name) {
+				rotate(descriptors.begin(), it, it + 1);
+				// Reset the conversion state.
+				::iconv(descriptors.front().second, nullptr, nullptr, nullptr, nullptr);
+				return descriptors.front().second;
+			}
+		}
+
+		iconv_t cd = iconv_open("utf-8", name.c_str());
+		if (cd == (iconv_t)-1)
+			throw runtime_error("Unsupported character set");
+
+		if (descriptors.size() == max_size) {
+			iconv_close(descriptors.back().second);
+			descriptors.pop_back();
+		}
+
+		descriptors.emplace(descriptors.begin(), move(name), cd);
+		return cd;
 	}
 };
 
+}
+
+static thread_local iconv_cache cache;
+
 string charset_decode(const string &charset, string_view in) {
-	iconv_state cd("utf-8", charset.c_str());
+	iconv_t cd = cache.get(charset);
 
 	string out;
 	out.reserve((in.size() * 102) / 100);
@@ -55,8 +102,8 @@ string charset_decode(const string &charset, string_view in) {
 
 	while (inbytesleft) {
 		outbuf = buf;
-		outbytesleft = sizeof outbuf;
-		size_t result = cd.convert(&inbuf, &inbytesleft, &outbuf, &outbytesleft);
+		outbytesleft = sizeof buf;
+		size_t result = ::iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
 		if (result == (size_t)-1) {
 			if (errno != E2BIG)
 				throw runtime_error("Character set conversion error");
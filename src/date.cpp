@@ -0,0 +1,314 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "date.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+static const char days[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char months[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static char *put2(char *p, int value) {
+	*p++ = '0' + value / 10;
+	*p++ = '0' + value % 10;
+	return p;
+}
+
+static char *put3(char *p, const char *str) {
+	memcpy(p, str, 3);
+	return p + 3;
+}
+
+// Formatting only depends on the second and the time zone, and messages are
+// usually stamped with the current time, so remember the last result for each
+// thread. The zone is identified by TZ and by the names tzset() set for it.
+namespace {
+
+struct date_cache {
+	bool valid = false;
+	time_t t = 0;
+	string tz;
+	string names[2];
+	string str;
+
+	static const char *get_tz() {
+		// An unset TZ is different from an empty one.
+		const char *tz = getenv("TZ");
+		return tz ? tz : "\n";
+	}
+
+	bool matches(time_t when) const {
+		return valid && t == when && tz == get_tz() && names[0] == tzname[0] && names[1] == tzname[1];
+	}
+
+	void assign(time_t when, const char *buf, size_t len) {
+		str.assign(buf, len);
+		t = when;
+		tz = get_tz();
+		names[0] = tzname[0];
+		names[1] = tzname[1];
+		valid = true;
+	}
+};
+
+}
+
+static thread_local date_cache cache;
+
+string date_format(const chrono::system_clock::time_point &date) {
+	time_t t = chrono::system_clock::to_time_t(date);
+
+	if (cache.matches(t))
+		return cache.str;
+
+	struct tm tm{};
+	localtime_r(&t, &tm);
+
+	// "Thu, 01 Jan 1970 00:00:00 +0000"
+	char buf[64];
+	char *p = buf;
+	p = put3(p, days[tm.tm_wday]);
+	*p++ = ',';
+	*p++ = ' ';
+	p = put2(p, tm.tm_mday);
+	*p++ = ' ';
+	p = put3(p, months[tm.tm_mon]);
+	*p++ = ' ';
+	p += snprintf(p, 16, "%d", tm.tm_year + 1900);
+	*p++ = ' ';
+	p = put2(p, tm.tm_hour);
+	*p++ = ':';
+	p = put2(p, tm.tm_min);
+	*p++ = ':';
+	p = put2(p, tm.tm_sec);
+	*p++ = ' ';
+
+	long offset = tm.tm_gmtoff / 60;
+	*p++ = offset < 0 ? '-' : '+';
+	if (offset < 0)
+		offset = -offset;
+	p = put2(p, offset / 60 % 100);
+	p = put2(p, offset % 60);
+
+	cache.assign(t, buf, p - buf);
+	return cache.str;
+}
+
+// Number of days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = static_cast<unsigned>(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+static int days_in_month(int year, int month) {
+	static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	return month == 2 && leap ? 29 : days[month - 1];
+}
+
+namespace {
+
+struct date_parser {
+	string_view str;
+	size_t pos = 0;
+
+	explicit date_parser(string_view str): str(str) {}
+
+	bool at_end() const {
+		return pos >= str.size();
+	}
+
+	char peek() const {
+		return at_end() ? 0 : str[pos];
+	}
+
+	// Skip folding whitespace and (possibly nested) comments.
+	void skip_cfws() {
+		int depth = 0;
+
+		while (!at_end()) {
+			char c = str[pos];
+			if (c == '(') {
+				depth++;
+			} else if (c == ')' && depth) {
+				depth--;
+			} else if (c == '\\' && depth) {
+				pos++;
+			} else if (!depth && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+				break;
+			}
+			pos++;
+		}
+	}
+
+	bool number(int &value, size_t &digits) {
+		skip_cfws();
+		value = 0;
+		digits = 0;
+
+		while (!at_end() && str[pos] >= '0' && str[pos] <= '9') {
+			if (digits < 9)
+				value = value * 10 + (str[pos] - '0');
+			digits++;
+			pos++;
+		}
+
+		return digits;
+	}
+
+	string_view word() {
+		skip_cfws();
+		size_t start = pos;
+
+		while (!at_end() && ((str[pos] | 0x20) >= 'a' && (str[pos] | 0x20) <= 'z'))
+			pos++;
+
+		return str.substr(start, pos - start);
+	}
+
+	bool expect(char c) {
+		skip_cfws();
+		if (peek() != c)
+			return false;
+		pos++;
+		return true;
+	}
+};
+
+}
+
+static bool prefix_equals(string_view word, const char *name) {
+	if (word.size() < 3)
+		return false;
+
+	for (size_t i = 0; i < 3; i++)
+		if ((word[i] | 0x20) != (name[i] | 0x20))
+			return false;
+
+	return true;
+}
+
+static bool word_equals(string_view word, const char *name) {
+	if (word.size() != strlen(name))
+		return false;
+
+	for (size_t i = 0; i < word.size(); i++)
+		if ((word[i] | 0x20) != (name[i] | 0x20))
+			return false;
+
+	return true;
+}
+
+// Offsets in minutes of the obsolete zone names of RFC 5322 section 4.3.
+// Military and unknown zones are treated as -0000, as recommended there.
+static int zone_offset(string_view name) {
+	static const struct {
+		const char *name;
+		int offset;
+	} zones[] = {
+		{"UT", 0}, {"UTC", 0}, {"GMT", 0},
+		{"EST", -5 * 60}, {"EDT", -4 * 60},
+		{"CST", -6 * 60}, {"CDT", -5 * 60},
+		{"MST", -7 * 60}, {"MDT", -6 * 60},
+		{"PST", -8 * 60}, {"PDT", -7 * 60},
+	};
+
+	for (auto &zone: zones)
+		if (word_equals(name, zone.name))
+			return zone.offset;
+
+	return 0;
+}
+
+bool date_parse(string_view str, chrono::system_clock::time_point &date) {
+	date_parser parser(str);
+	int value;
+	size_t digits;
+
+	// Optional day of the week.
+	auto dow = parser.word();
+	if (!dow.empty() && !parser.expect(','))
+		return false;
+
+	int day;
+	if (!parser.number(day, digits) || digits > 2)
+		return false;
+
+	auto month_name = parser.word();
+	int month = 0;
+	for (int i = 0; i < 12; i++) {
+		if (prefix_equals(month_name, months[i])) {
+			month = i + 1;
+			break;
+		}
+	}
+	if (!month)
+		return false;
+
+	int year;
+	if (!parser.number(year, digits) || digits > 4)
+		return false;
+	if (digits == 2)
+		year += year < 50 ? 2000 : 1900;
+	else if (digits == 3)
+		year += 1900;
+
+	int hour, minute, second = 0;
+	if (!parser.number(hour, digits) || digits > 2 || !parser.expect(':'))
+		return false;
+	if (!parser.number(minute, digits) || digits > 2)
+		return false;
+	if (parser.expect(':') && (!parser.number(second, digits) || digits > 2))
+		return false;
+
+	if (day < 1 || day > days_in_month(year, month) || hour > 23 || minute > 59 || second > 60)
+		return false;
+
+	// A missing zone is treated as -0000.
+	int offset = 0;
+	parser.skip_cfws();
+	char sign = parser.peek();
+	if (sign == '+' || sign == '-') {
+		// The digits follow the sign directly.
+		parser.pos++;
+		char first = parser.peek();
+		if (first < '0' || first > '9' || !parser.number(value, digits) || digits != 4 || value % 100 > 59)
+			return false;
+		offset = value / 100 * 60 + value % 100;
+		if (sign == '-')
+			offset = -offset;
+	} else {
+		offset = zone_offset(parser.word());
+	}
+
+	int64_t seconds = days_from_civil(year, month, day) * 86400
+		+ hour * 3600 + minute * 60 + second
+		- offset * 60;
+
+	date = chrono::system_clock::time_point(chrono::seconds(seconds));
+	return true;
+}
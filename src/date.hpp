@@ -0,0 +1,28 @@
+#pragma once
+
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <string>
+#include "string_view.hpp"
+
+// Formats a date as specified in RFC 5322 section 3.3, using the local time zone.
+std::string date_format(const std::chrono::system_clock::time_point &date);
+
+// Parses an RFC 5322 date, including the obsolete syntax. Returns false if the date is invalid.
+bool date_parse(std::string_view str, std::chrono::system_clock::time_point &date);
@@ -0,0 +1,601 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mimesis.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <strings.h>
+
+#include "body-file.hpp"
+
+using namespace std;
+
+namespace Mimesis {
+
+// Strings are quoted if possible, otherwise they are sent as a literal.
+static void append_string(string &out, const char *data, size_t len) {
+	bool quotable = true;
+	for (size_t i = 0; i < len && quotable; i++)
+		quotable = data[i] != '\r' && data[i] != '\n' && static_cast<unsigned char>(data[i]) < 128;
+
+	if (!quotable) {
+		out.push_back('{');
+		out.append(std::to_string(len));
+		out.append("}\r\n");
+		out.append(data, len);
+		return;
+	}
+
+	out.push_back('"');
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] == '"' || data[i] == '\\')
+			out.push_back('\\');
+		out.push_back(data[i]);
+	}
+	out.push_back('"');
+}
+
+static void append_string(string &out, const string &str, size_t start = 0, size_t end = string::npos) {
+	end = min(end, str.size());
+	append_string(out, str.data() + start, end - start);
+}
+
+static void append_nstring(string &out, const string &str, size_t start = 0, size_t end = string::npos) {
+	if (min(end, str.size()) <= start)
+		out.append("NIL");
+	else
+		append_string(out, str, start, end);
+}
+
+static bool is_space(char c) {
+	return isspace(static_cast<unsigned char>(c));
+}
+
+// Narrows [start, end) so it doesn't begin or end with whitespace.
+static void trim(const string &str, size_t &start, size_t &end) {
+	while (start < end && is_space(str[start]))
+		start++;
+	while (end > start && is_space(str[end - 1]))
+		end--;
+}
+
+// Appends the parameters of a structured header field, like ("charset" "us-ascii").
+static void append_parameters(string &out, const string &value) {
+	string param;
+	bool any = false;
+	size_t pos = value.find(';');
+
+	while (pos < value.size()) {
+		size_t name_start = pos + 1;
+		size_t eq = value.find('=', name_start);
+		if (eq == string::npos)
+			break;
+
+		size_t name_end = eq;
+		trim(value, name_start, name_end);
+
+		param.clear();
+		size_t i = eq + 1;
+		while (i < value.size() && is_space(value[i]))
+			i++;
+
+		if (i < value.size() && value[i] == '"') {
+			for (i++; i < value.size() && value[i] != '"'; i++) {
+				if (value[i] == '\\' && i + 1 < value.size())
+					i++;
+				param.push_back(value[i]);
+			}
+			pos = value.find(';', i);
+		} else {
+			pos = value.find(';', i);
+			size_t end = min(pos, value.size());
+			trim(value, i, end);
+			param.assign(value, i, end - i);
+		}
+
+		if (name_start == name_end)
+			continue;
+
+		out.append(any ? " " : "(");
+		append_string(out, value, name_start, name_end);
+		out.push_back(' ');
+		append_string(out, param);
+		any = true;
+	}
+
+	out.append(any ? ")" : "NIL");
+}
+
+// Appends a disposition like ("attachment" ("filename" "foo.txt")), or NIL.
+static void append_disposition(string &out, const string &value) {
+	size_t start = 0;
+	size_t end = min(value.find(';'), value.size());
+	trim(value, start, end);
+
+	if (start == end) {
+		out.append("NIL");
+		return;
+	}
+
+	out.push_back('(');
+	append_string(out, value, start, end);
+	out.push_back(' ');
+	append_parameters(out, value);
+	out.push_back(')');
+}
+
+static size_t count_lines(const char *data, size_t len) {
+	size_t lines = 0;
+	const char *end = data + len;
+	while ((data = static_cast<const char *>(memchr(data, '\n', end - data)))) {
+		lines++;
+		data++;
+	}
+	return lines;
+}
+
+// BODYSTRUCTURE, see RFC 3501 section 7.4.2
+
+void Part::write_bodystructure(string &out, bool extended) const {
+	auto &content_type = (*this)["Content-Type"];
+	size_t type_start = 0;
+	size_t type_end = min(content_type.find(';'), content_type.size());
+	trim(content_type, type_start, type_end);
+	size_t slash = min(content_type.find('/', type_start), type_end);
+
+	out.push_back('(');
+
+	if (multipart) {
+		for (auto &part: parts)
+			part.write_bodystructure(out, extended);
+		out.push_back(' ');
+		append_string(out, content_type, min(slash + 1, type_end), type_end);
+
+		if (extended) {
+			out.push_back(' ');
+			append_parameters(out, content_type);
+			out.push_back(' ');
+			append_disposition(out, (*this)["Content-Disposition"]);
+			out.push_back(' ');
+			append_nstring(out, (*this)["Content-Language"]);
+			out.push_back(' ');
+			append_nstring(out, (*this)["Content-Location"]);
+		}
+
+		out.push_back(')');
+		return;
+	}
+
+	// Parts without a type are plain text, see RFC 2045 section 5.2.
+	bool text = true;
+	const Message *message = nullptr;
+	if (type_start == type_end) {
+		out.append("\"text\" \"plain\" (\"charset\" \"us-ascii\")");
+	} else if (is_mime_type("message/rfc822") && !(message = get_message())) {
+		// Nested too deeply to be parsed, see ParseLimits::max_depth.
+		out.append("\"application\" \"octet-stream\" NIL");
+		text = false;
+	} else {
+		append_string(out, content_type, type_start, slash);
+		out.push_back(' ');
+		append_nstring(out, content_type, min(slash + 1, type_end), type_end);
+		out.push_back(' ');
+		append_parameters(out, content_type);
+		text = slash - type_start == 4 && !strncasecmp(content_type.c_str() + type_start, "text", 4);
+	}
+
+	out.push_back(' ');
+	append_nstring(out, (*this)["Content-ID"]);
+	out.push_back(' ');
+	append_nstring(out, (*this)["Content-Description"]);
+	out.push_back(' ');
+	auto &encoding = (*this)["Content-Transfer-Encoding"];
+	if (encoding.empty())
+		out.append("\"7bit\"");
+	else
+		append_string(out, encoding);
+
+	// Sizes are those of the encoded body, as it would be saved.
+	size_t octets = body.size();
+	size_t lines = 0;
+	if (embedded.is_modified()) {
+		auto saved = embedded.get()->to_string();
+		octets = saved.size();
+		lines = count_lines(saved.data(), saved.size());
+	} else if (body_file) {
+		string line_ending = crlf ? "\r\n" : "\n";
+		octets = body_file->get_saved_size(line_ending);
+		if ((text || message) && body_file->is_base64()) {
+			// Encoded in lines of 76 characters, or 57 bytes.
+			size_t size = body_file->get_size();
+			lines = size / 57 + (size % 57 != 0);
+		} else if (text || message) {
+			body_file->read_saved(line_ending, [&](const char *data, size_t len) {
+				lines += count_lines(data, len);
+			});
+		}
+	} else if (text || message) {
+		lines = count_lines(body.str().data(), body.size());
+	}
+
+	out.push_back(' ');
+	out.append(std::to_string(octets));
+
+	if (message) {
+		out.push_back(' ');
+		out.append(message->get_envelope());
+		out.push_back(' ');
+		message->write_bodystructure(out, extended);
+	}
+
+	if (text || message) {
+		out.push_back(' ');
+		out.append(std::to_string(lines));
+	}
+
+	if (extended) {
+		out.push_back(' ');
+		append_nstring(out, (*this)["Content-MD5"]);
+		out.push_back(' ');
+		append_disposition(out, (*this)["Content-Disposition"]);
+		out.push_back(' ');
+		append_nstring(out, (*this)["Content-Language"]);
+		out.push_back(' ');
+		append_nstring(out, (*this)["Content-Location"]);
+	}
+
+	out.push_back(')');
+}
+
+string Part::get_bodystructure(bool extended) const {
+	string out;
+	write_bodystructure(out, extended);
+	return out;
+}
+
+// ENVELOPE, see RFC 3501 section 7.4.2
+
+// Appends a single address, like ("John Doe" NIL "john" "example.org").
+static void append_address(string &out, const string &value, size_t start, size_t end) {
+	trim(value, start, end);
+	if (start == end)
+		return;
+
+	// Find the angle brackets, if any, outside of quoted strings and comments.
+	size_t lt = string::npos;
+	size_t gt = end;
+	bool quoted = false;
+	int comment = 0;
+
+	for (size_t i = start; i < end; i++) {
+		char c = value[i];
+		if (quoted || comment) {
+			if (c == '\\')
+				i++;
+			else if (quoted && c == '"')
+				quoted = false;
+			else if (comment && c == '(')
+				comment++;
+			else if (comment && c == ')')
+				comment--;
+		} else if (c == '"') {
+			quoted = true;
+		} else if (c == '(') {
+			comment++;
+		} else if (c == '<' && lt == string::npos) {
+			lt = i;
+		} else if (c == '>' && lt != string::npos) {
+			gt = i;
+			break;
+		}
+	}
+
+	string name;
+	size_t addr_start = start;
+	size_t addr_end = end;
+
+	if (lt != string::npos) {
+		size_t name_start = start;
+		size_t name_end = lt;
+		trim(value, name_start, name_end);
+		if (name_end - name_start >= 2 && value[name_start] == '"' && value[name_end - 1] == '"') {
+			for (size_t i = name_start + 1; i < name_end - 1; i++) {
+				if (value[i] == '\\' && i + 2 < name_end)
+					i++;
+				name.push_back(value[i]);
+			}
+		} else {
+			name.assign(value, name_start, name_end - name_start);
+		}
+		addr_start = lt + 1;
+		addr_end = gt;
+	} else {
+		// Ignore a trailing comment.
+		addr_end = min(value.find('(', start), end);
+	}
+
+	trim(value, addr_start, addr_end);
+
+	// An obsolete source route, like @a,@b:user@host
+	size_t route_start = 0;
+	size_t route_end = 0;
+	if (addr_start < addr_end && value[addr_start] == '@') {
+		size_t colon = value.find(':', addr_start);
+		if (colon < addr_end) {
+			route_start = addr_start;
+			route_end = colon;
+			addr_start = colon + 1;
+		}
+	}
+
+	size_t at = value.rfind('@', addr_end - 1);
+	if (at == string::npos || at < addr_start)
+		at = addr_end;
+
+	out.push_back('(');
+	append_nstring(out, name);
+	out.push_back(' ');
+	append_nstring(out, value, route_start, route_end);
+	out.push_back(' ');
+	append_nstring(out, value, addr_start, at);
+	out.push_back(' ');
+	append_nstring(out, value, min(at + 1, addr_end), addr_end);
+	out.push_back(')');
+}
+
+// Appends a list of addresses, including groups, or NIL if there are none.
+static void append_addresses(string &out, const string &value) {
+	size_t mark = out.size();
+	out.push_back('(');
+
+	size_t start = 0;
+	bool quoted = false;
+	int comment = 0;
+	bool angle = false;
+	bool group = false;
+
+	for (size_t i = 0; i <= value.size(); i++) {
+		char c = i < value.size() ? value[i] : ',';
+
+		if (quoted || comment) {
+			if (c == '\\' && i + 1 < value.size())
+				i++;
+			else if (quoted && c == '"')
+				quoted = false;
+			else if (comment && c == '(')
+				comment++;
+			else if (comment && c == ')')
+				comment--;
+			continue;
+		}
+
+		if (c == '"') {
+			quoted = true;
+		} else if (c == '(') {
+			comment++;
+		} else if (c == '<') {
+			angle = true;
+		} else if (c == '>') {
+			angle = false;
+		} else if (angle) {
+			continue;
+		} else if (c == ':' && !group) {
+			// The start of a group is marked by an address without a host.
+			size_t name_start = start;
+			size_t name_end = i;
+			trim(value, name_start, name_end);
+			out.append("(NIL NIL ");
+			append_string(out, value, name_start, name_end);
+			out.append(" NIL)");
+			group = true;
+			start = i + 1;
+		} else if (c == ',' || (c == ';' && group)) {
+			append_address(out, value, start, i);
+			if (c == ';') {
+				out.append("(NIL NIL NIL NIL)");
+				group = false;
+			}
+			start = i + 1;
+		}
+	}
+
+	if (group)
+		out.append("(NIL NIL NIL NIL)");
+
+	if (out.size() == mark + 1) {
+		out.resize(mark);
+		out.append("NIL");
+	} else {
+		out.push_back(')');
+	}
+}
+
+string Part::get_envelope() const {
+	auto &from = (*this)["From"];
+	auto &sender = (*this)["Sender"];
+	auto &reply_to = (*this)["Reply-To"];
+
+	string out = "(";
+	append_nstring(out, (*this)["Date"]);
+	out.push_back(' ');
+	append_nstring(out, (*this)["Subject"]);
+	out.push_back(' ');
+	append_addresses(out, from);
+	out.push_back(' ');
+	append_addresses(out, sender.empty() ? from : sender);
+	out.push_back(' ');
+	append_addresses(out, reply_to.empty() ? from : reply_to);
+	out.push_back(' ');
+	append_addresses(out, (*this)["To"]);
+	out.push_back(' ');
+	append_addresses(out, (*this)["Cc"]);
+	out.push_back(' ');
+	append_addresses(out, (*this)["Bcc"]);
+	out.push_back(' ');
+	append_nstring(out, (*this)["In-Reply-To"]);
+	out.push_back(' ');
+	append_nstring(out, (*this)["Message-ID"]);
+	out.push_back(')');
+	return out;
+}
+
+// BODY[section], see RFC 3501 section 6.4.5
+
+static bool starts_with(const string &str, size_t pos, const char *prefix) {
+	size_t len = strlen(prefix);
+	return str.size() - pos >= len && !strncasecmp(str.c_str() + pos, prefix, len);
+}
+
+// Parses the list of a HEADER.FIELDS specifier, such as " (From \"To\")".
+static vector<string> parse_field_list(const string &section, size_t pos) {
+	vector<string> fields;
+
+	if (section.compare(pos, 2, " (") || section.back() != ')')
+		throw runtime_error("invalid section");
+
+	size_t end = section.size() - 1;
+	pos += 2;
+
+	while (pos < end) {
+		if (section[pos] == ' ') {
+			pos++;
+			continue;
+		}
+
+		size_t start = pos;
+		if (section[pos] == '"') {
+			start++;
+			pos = section.find('"', start);
+			if (pos >= end)
+				throw runtime_error("invalid section");
+			fields.emplace_back(section, start, pos - start);
+			pos++;
+		} else {
+			pos = min(section.find(' ', pos), end);
+			fields.emplace_back(section, start, pos - start);
+		}
+	}
+
+	if (fields.empty())
+		throw runtime_error("invalid section");
+
+	return fields;
+}
+
+string Part::get_section(const string &section, size_t offset, size_t length) const {
+	// Part numbers select children of multiparts. Part 1 of a single part
+	// message is its body. Part numbers after a message/rfc822 part refer to
+	// the parts of the embedded message.
+	const Part *part = this;
+	bool is_message = true;
+	size_t pos = 0;
+
+	while (pos < section.size() && isdigit(static_cast<unsigned char>(section[pos]))) {
+		size_t number = 0;
+		for (; pos < section.size() && isdigit(static_cast<unsigned char>(section[pos])); pos++) {
+			if (number > 100000000)
+				throw runtime_error("invalid section");
+			number = number * 10 + (section[pos] - '0');
+		}
+
+		if (!number)
+			throw runtime_error("invalid section");
+
+		if (!is_message) {
+			if (auto inner = part->get_message()) {
+				part = inner;
+				is_message = true;
+			}
+		}
+
+		if (part->multipart) {
+			if (number > part->parts.size())
+				return {};
+			part = &part->parts[number - 1];
+		} else if (!is_message || number != 1) {
+			return {};
+		}
+
+		is_message = false;
+
+		if (pos < section.size() && (section[pos] != '.' || pos + 1 == section.size()))
+			throw runtime_error("invalid section");
+		pos++;
+	}
+
+	pos = min(pos, section.size());
+
+	if (pos == section.size()) {
+		string out;
+		part->write_range(out, !pos, true, offset, length);
+		return out;
+	}
+
+	if (!strcasecmp(section.c_str() + pos, "MIME")) {
+		if (!pos)
+			throw runtime_error("invalid section");
+		string out;
+		part->write_range(out, true, false, offset, length);
+		return out;
+	}
+
+	bool header = starts_with(section, pos, "HEADER");
+	bool text = !strcasecmp(section.c_str() + pos, "TEXT");
+	if (!header && !text)
+		throw runtime_error("invalid section");
+
+	// The other specifiers refer to the message, or to the message embedded in the part.
+	if (pos) {
+		part = part->get_message();
+		if (!part)
+			return {};
+	}
+
+	string out;
+
+	if (text || section.size() == pos + 6) {
+		part->write_range(out, header, text, offset, length);
+		return out;
+	}
+
+	pos += 6;
+	bool exclude;
+	if (starts_with(section, pos, ".FIELDS.NOT")) {
+		exclude = true;
+		pos += 11;
+	} else if (starts_with(section, pos, ".FIELDS")) {
+		exclude = false;
+		pos += 7;
+	} else {
+		throw runtime_error("invalid section");
+	}
+
+	// The fields are written as they would be saved, like for HEADER.
+	auto fields = parse_field_list(section, pos);
+	part->write_range(out, true, false, offset, length, [&](const string &name) {
+		for (auto &field: fields)
+			if (!strcasecmp(name.c_str(), field.c_str()))
+				return !exclude;
+		return exclude;
+	});
+	return out;
+}
+
+}
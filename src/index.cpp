@@ -0,0 +1,288 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mimesis.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Mimesis {
+
+const uint32_t MessageIndex::npos;
+const uint32_t MessageIndex::version;
+
+static const char magic[8] = {'M', 'I', 'M', 'E', 'S', 'I', 'D', 'X'};
+
+static bool get_file_info(const string &filename, uint64_t &size, int64_t &mtime) {
+	struct stat st;
+	if (stat(filename.c_str(), &st))
+		return false;
+
+	size = st.st_size;
+#ifdef __APPLE__
+	mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+void MessageIndex::set_file(const string &message_filename) {
+	if (!get_file_info(message_filename, file_size, file_mtime))
+		throw runtime_error("could not stat message file");
+}
+
+bool MessageIndex::is_valid_for(const string &message_filename) const {
+	uint64_t size;
+	int64_t mtime;
+	return get_file_info(message_filename, size, mtime) && size == file_size && mtime == file_mtime;
+}
+
+// The index is stored in little-endian byte order.
+
+static void put(string &out, uint64_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++)
+		out.push_back(char(value >> (8 * i)));
+}
+
+// Longer strings are truncated.
+static void put(string &out, const string &str) {
+	auto len = min<size_t>(str.size(), 0xffff);
+	put(out, len, 2);
+	out.append(str, 0, len);
+}
+
+namespace {
+
+struct reader {
+	const string &data;
+	size_t pos;
+	bool ok;
+
+	uint64_t get(size_t bytes) {
+		uint64_t value = 0;
+		if (data.size() - pos < bytes) {
+			ok = false;
+			return value;
+		}
+		for (size_t i = 0; i < bytes; i++)
+			value |= uint64_t(uint8_t(data[pos + i])) << (8 * i);
+		pos += bytes;
+		return value;
+	}
+
+	string get_string() {
+		size_t len = get(2);
+		if (data.size() - pos < len) {
+			ok = false;
+			return {};
+		}
+		pos += len;
+		return data.substr(pos - len, len);
+	}
+};
+
+}
+
+void MessageIndex::save(const string &filename) const {
+	string out(magic, sizeof magic);
+	put(out, version, 4);
+	put(out, entries.size(), 4);
+	put(out, file_size, 8);
+	put(out, file_mtime, 8);
+
+	for (auto &entry: entries) {
+		put(out, entry.parent, 4);
+		put(out, entry.header_offset, 8);
+		put(out, entry.header_length, 8);
+		put(out, entry.body_offset, 8);
+		put(out, entry.body_length, 8);
+		put(out, entry.body_lines, 8);
+		put(out, entry.content_type);
+		put(out, entry.transfer_encoding);
+	}
+
+	ofstream file(filename, ios::binary);
+	if (!file.is_open())
+		throw runtime_error("could not open index file");
+	file.write(out.data(), out.size());
+	file.close();
+	if (file.fail())
+		throw runtime_error("could not write index file");
+}
+
+bool MessageIndex::load(const string &filename, const string &message_filename) {
+	ifstream file(filename, ios::binary);
+	if (!file.is_open())
+		return false;
+
+	string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	if (data.size() < sizeof magic || data.compare(0, sizeof magic, magic, sizeof magic))
+		return false;
+
+	reader in{data, sizeof magic, true};
+	if (in.get(4) != version)
+		return false;
+
+	size_t count = in.get(4);
+	MessageIndex index;
+	index.file_size = in.get(8);
+	index.file_mtime = in.get(8);
+
+	// Each entry takes at least 48 bytes, with empty strings.
+	if (!in.ok || count > (data.size() - in.pos) / 48)
+		return false;
+
+	index.entries.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		auto &entry = index.entries[i];
+		entry.parent = in.get(4);
+		entry.header_offset = in.get(8);
+		entry.header_length = in.get(8);
+		entry.body_offset = in.get(8);
+		entry.body_length = in.get(8);
+		entry.body_lines = in.get(8);
+		entry.content_type = in.get_string();
+		entry.transfer_encoding = in.get_string();
+
+		if (!in.ok || (i ? entry.parent >= i : entry.parent != npos))
+			return false;
+		if (entry.body_offset > index.file_size || entry.body_length > index.file_size - entry.body_offset)
+			return false;
+	}
+
+	if (!in.ok || in.pos != data.size() || !index.is_valid_for(message_filename))
+		return false;
+
+	*this = move(index);
+	return true;
+}
+
+const IndexEntry *MessageIndex::find(const string &section) const {
+	if (entries.empty())
+		return nullptr;
+
+	uint32_t current = 0;
+	size_t pos = 0;
+
+	while (pos < section.size()) {
+		size_t end = section.find('.', pos);
+		if (end == string::npos)
+			end = section.size();
+		else if (end + 1 == section.size())
+			return nullptr;
+
+		auto number = section.substr(pos, end - pos);
+		if (number.empty() || number.find_first_not_of("0123456789") != string::npos)
+			return nullptr;
+
+		auto n = strtoul(number.c_str(), nullptr, 10);
+		bool has_children = current + 1 < entries.size() && entries[current + 1].parent == current;
+
+		if (has_children) {
+			// Children follow their parent, and are followed by their own children.
+			uint32_t child = npos;
+			for (uint32_t i = current + 1; i < entries.size() && n; i++)
+				if (entries[i].parent == current && !--n)
+					child = i;
+			if (child == npos)
+				return nullptr;
+			current = child;
+		} else if (n != 1) {
+			// A single part is its own first part.
+			return nullptr;
+		}
+
+		pos = end + 1;
+	}
+
+	return &entries[current];
+}
+
+string MessageIndex::get_section(uint32_t entry) const {
+	string section;
+
+	while (entry && entry < entries.size()) {
+		auto parent = entries[entry].parent;
+		size_t n = 0;
+		for (uint32_t i = parent + 1; i <= entry; i++)
+			n += entries[i].parent == parent;
+
+		section.insert(0, std::to_string(n) + (section.empty() ? "" : "."));
+		entry = parent;
+	}
+
+	return section;
+}
+
+MappedRange::MappedRange(const string &filename, uint64_t offset, uint64_t length): map(nullptr), map_size(0), start(nullptr), length(length) {
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		throw runtime_error("could not open message file");
+
+	struct stat st;
+	if (fstat(fd, &st) || offset > uint64_t(st.st_size) || length > uint64_t(st.st_size) - offset) {
+		close(fd);
+		throw runtime_error("range is outside of the message file");
+	}
+
+	if (!length) {
+		close(fd);
+		return;
+	}
+
+	// The offset of a mapping must be a multiple of the page size.
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uint64_t aligned = offset - offset % page_size;
+	map_size = length + (offset - aligned);
+	map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, aligned);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		throw runtime_error("could not map message file");
+
+	start = static_cast<const char *>(map) + (offset - aligned);
+}
+
+MappedRange::~MappedRange() {
+	if (map)
+		munmap(map, map_size);
+}
+
+const char *MappedRange::data() const {
+	return start;
+}
+
+size_t MappedRange::size() const {
+	return length;
+}
+
+string MappedRange::to_string() const {
+	return string(start ? start : "", length);
+}
+
+}
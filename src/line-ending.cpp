@@ -0,0 +1,101 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "line-ending.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Both conversions copy runs of bytes between the line endings that need to
+// change. Line endings are found 16 bytes at a time where SSE2 is available.
+
+string lf_to_crlf(string_view in) {
+	string out;
+	out.reserve(in.size() + in.size() / 32);
+
+	const char *begin = in.data();
+	const char *end = begin + in.size();
+	const char *start = begin;
+	const char *p = begin;
+
+	auto convert = [&](const char *lf) {
+		if (lf > begin && lf[-1] == '\r')
+			return;
+		out.append(start, lf - start);
+		out.push_back('\r');
+		start = lf;
+	};
+
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; end - p >= 16; p += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+		while (mask) {
+			convert(p + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; p < end; p++)
+		if (*p == '\n')
+			convert(p);
+
+	out.append(start, end - start);
+	return out;
+}
+
+string crlf_to_lf(string_view in) {
+	string out;
+	out.reserve(in.size());
+
+	const char *begin = in.data();
+	const char *end = begin + in.size();
+	const char *start = begin;
+	const char *p = begin;
+
+	auto convert = [&](const char *cr) {
+		if (cr + 1 == end || cr[1] != '\n')
+			return;
+		out.append(start, cr - start);
+		start = cr + 1;
+	};
+
+#ifdef __SSE2__
+	const __m128i carriage_return = _mm_set1_epi8('\r');
+	for (; end - p >= 16; p += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, carriage_return));
+		while (mask) {
+			convert(p + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; p < end; p++)
+		if (*p == '\r')
+			convert(p);
+
+	out.append(start, end - start);
+	return out;
+}
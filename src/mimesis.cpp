@@ -18,24 +18,34 @@
 #include "mimesis.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <iostream>
+#include <new>
 #include <fstream>
-#include <random>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "base64.hpp"
+#include "body-file.hpp"
 #include "charset.hpp"
+#include "date.hpp"
+#include "line-ending.hpp"
+#include "parser.hpp"
 #include "quoted-printable.hpp"
+#include "random.hpp"
 #include "string_view.hpp"
 
 using namespace std;
 
 namespace Mimesis {
 
-static std::random_device rnd;
-
 static string unquote(const string &str) {
 	if (str.empty() || str[0] != '"')
 		return str;
@@ -131,7 +141,9 @@ static string decode_header(const string &str) {
 	string decoded;
 
 	while (start != str.npos) {
-		decoded.append(str, from, start - from);
+		// Whitespace between two encoded words is ignored, see RFC 2047 section 6.2.
+		if (!from || str.find_first_not_of(" \t\r\n", from) < start)
+			decoded.append(str, from, start - from);
 		size_t encoding = str.find("?", start + 2);
 		if (encoding == str.npos)
 			return str;
@@ -143,8 +155,10 @@ static string decode_header(const string &str) {
 			return str;
 		string charset = str.substr(start + 2, encoding - (start + 2));
 		string todo = str.substr(text + 1, end - (text + 1));
-		if (streqi(str, encoding + 1, 1, "q"))
+		if (streqi(str, encoding + 1, 1, "q")) {
+			replace(todo.begin(), todo.end(), '_', ' ');
 			todo = quoted_printable_decode(todo);
+		}
 		else if (streqi(str, encoding + 1, 1, "b"))
 			todo = base64_decode(todo);
 		else
@@ -156,14 +170,23 @@ static string decode_header(const string &str) {
 		start = str.find("=?", from);
 	}
 
+	decoded.append(str, from, string::npos);
 	return decoded;
 }
 
+// A header that cannot be decoded is returned as it is.
+static string try_decode_header(const string &str) {
+	try {
+		return decode_header(str);
+	} catch (runtime_error &) {
+		return str;
+	}
+}
+
 static string generate_boundary() {
-	unsigned int nonce[24 / sizeof(unsigned int)];
-	for (auto &val: nonce)
-		val = rnd();
-	return base64_encode(string_view(reinterpret_cast<char *>(nonce), sizeof nonce));
+	char nonce[24];
+	random_bytes(nonce, sizeof nonce);
+	return base64_encode(string_view(nonce, sizeof nonce));
 }
 
 static bool is_boundary(const std::string &line, const std::string &boundary) {
@@ -255,6 +278,9 @@ static pair<size_t, size_t> get_parameter_value_range(const string &str, const s
 					end++;
 				end++;
 			}
+			// Include the closing quote.
+			if (end < str.size())
+				end++;
 		} else {
 			while (end < str.size() && str[end] != ';' && !isspace(str[end]))
 				end++;
@@ -289,29 +315,325 @@ static string get_parameter(const string &str, const string &parameter) {
 }
 
 static const string ending[2] = {"\n", "\r\n"};
+static const string empty_string;
+
+// Shared strings
+
+SharedString::SharedString(const string &str): data(make_shared<string>(str)) {}
+
+SharedString::SharedString(string &&str): data(make_shared<string>(move(str))) {}
+
+SharedString &SharedString::operator=(const string &str) {
+	data = make_shared<string>(str);
+	return *this;
+}
+
+SharedString &SharedString::operator=(string &&str) {
+	data = make_shared<string>(move(str));
+	return *this;
+}
+
+string &SharedString::modify() {
+	if (!data)
+		data = make_shared<string>();
+	else if (data.use_count() > 1)
+		data = make_shared<string>(*data);
+	return *data;
+}
+
+const string &SharedString::str() const {
+	return data ? *data : empty_string;
+}
+
+bool SharedString::empty() const {
+	return !data || data->empty();
+}
+
+size_t SharedString::size() const {
+	return data ? data->size() : 0;
+}
+
+void SharedString::append(const string &str) {
+	modify().append(str);
+}
+
+void SharedString::append(const char *buf, size_t len) {
+	modify().append(buf, len);
+}
+
+void SharedString::clear() {
+	data.reset();
+}
+
+bool operator==(const SharedString &lhs, const SharedString &rhs) {
+	return lhs.data == rhs.data || lhs.str() == rhs.str();
+}
+
+bool operator!=(const SharedString &lhs, const SharedString &rhs) {
+	return !(lhs == rhs);
+}
+
+MessageCache::MessageCache(const MessageCache &other):
+		message(atomic_load(&other.message)),
+		limits(other.limits),
+		modified(other.modified)
+{}
+
+MessageCache &MessageCache::operator=(const MessageCache &other) {
+	message = atomic_load(&other.message);
+	limits = other.limits;
+	modified = other.modified;
+	return *this;
+}
+
+shared_ptr<Message> MessageCache::get() const {
+	return atomic_load(&message);
+}
+
+// Stores a newly parsed message, unless another thread did so first.
+// Returns the message that is stored.
+shared_ptr<Message> MessageCache::set(shared_ptr<Message> parsed) const {
+	shared_ptr<Message> expected;
+	if (atomic_compare_exchange_strong(&message, &expected, parsed))
+		return parsed;
+	return expected;
+}
+
+void MessageCache::assign(shared_ptr<Message> value) {
+	message = move(value);
+	modified = true;
+}
+
+Message &MessageCache::modify() {
+	if (message.use_count() > 1)
+		message = make_shared<Message>(*message);
+	modified = true;
+	return *message;
+}
+
+bool MessageCache::is_modified() const {
+	return modified;
+}
+
+void MessageCache::reset() {
+	message.reset();
+	modified = false;
+}
+
+void MessageCache::set_limits(shared_ptr<const ParseLimits> value) {
+	limits = move(value);
+}
+
+const ParseLimits *MessageCache::get_limits() const {
+	return limits.get();
+}
 
 Part::Part():
 		headers(),
 		preamble(),
 		body(),
+		body_file(),
+		embedded(),
 		epilogue(),
 		parts(),
 		boundary(),
+		raw_header(),
+		raw_delimiter(),
+		raw_close(),
+		body_offset(0),
+		body_length(0),
 		multipart(false),
 		crlf(true),
+		partial(false),
 		message(false)
 {}
 
-// Loading and saving a whole MIME message
+// Parsing
+
+Parser::Parser(istream &in, const ParseOptions &options, Handler &handler):
+		in(in),
+		options(options),
+		handler(handler),
+		result(),
+		offset(0),
+		line_offset(0),
+		nlines(0),
+		nparts(0),
+		total_size(0),
+		terminated(false),
+		convert(options.line_ending != LineEnding::keep)
+{}
 
-string Part::load(istream &in, const string &parent_boundary) {
+const ParseResult &Parser::get_result() const {
+	return result;
+}
+
+size_t Parser::get_offset() const {
+	return offset;
+}
+
+bool Parser::getline(string &line) {
+	if (terminated)
+		return false;
+
+	line_offset = offset;
+
+	if (!std::getline(in, line))
+		return false;
+
+	// The newline is consumed unless we hit the end of the input.
+	offset += line.size() + !in.eof();
+	nlines++;
+
+	if (options.smtp_data && !line.empty() && line[0] == '.') {
+		if (line.size() == 1 || (line.size() == 2 && line[1] == '\r')) {
+			terminated = true;
+			return false;
+		}
+		line.erase(0, 1);
+	}
+
+	if (convert)
+		convert_line(line);
+
+	return true;
+}
+
+// The newline itself has already been removed from the line.
+void Parser::convert_line(string &line) {
+	bool cr = !line.empty() && line.back() == '\r';
+	if (options.line_ending == LineEnding::crlf && !cr)
+		line.push_back('\r');
+	else if (options.line_ending == LineEnding::lf && cr)
+		line.pop_back();
+}
+
+bool Parser::fail(ParseError error, const char *reason, size_t error_offset, bool recoverable) {
+	if (recoverable && options.recover) {
+		result.recovered++;
+		return true;
+	}
+
+	result.error = error;
+	result.reason = reason;
+	result.offset = error_offset;
+	return false;
+}
+
+// Passes a line of text to the handler, enforcing the size limits.
+bool Parser::add_text(void (Handler::*add)(const string &), string &line, size_t &size) {
+	auto &limits = options.limits;
+	size_t room = min(limits.max_body_size - size, limits.max_total_size - total_size);
+
+	if (line.size() > room) {
+		if (!limits.truncate) {
+			if (line.size() > limits.max_body_size - size)
+				return fail(ParseError::body_too_large, "body too large", line_offset, false);
+			else
+				return fail(ParseError::message_too_large, "message too large", line_offset, false);
+		}
+
+		result.truncated = true;
+		if (!room)
+			return true;
+		line.resize(room);
+	}
+
+	size += line.size();
+	total_size += line.size();
+	(handler.*add)(line);
+	return true;
+}
+
+bool Parser::parse(const string &parent_boundary, string &last_line) {
+	last_line.clear();
+
+	// An index can be reused for another message.
+	if (options.index)
+		options.index->entries.clear();
+
+	bool ok = parse_part(parent_boundary, last_line, 0, MessageIndex::npos);
+
+	if (ok && options.smtp_data && !terminated)
+		ok = fail(ParseError::unterminated_data, "missing end of data", offset, true);
+
+	result.bytes_read = offset;
+	return ok;
+}
+
+bool Parser::parse_part(const string &parent_boundary, string &last_line, size_t depth, uint32_t parent_entry) {
+	auto &limits = options.limits;
 	string line;
+	string field;
+	string value;
+	string content_type;
+	bool have_content_type = false;
+	size_t header_bytes = 0;
+	size_t size = 0;
 	int ncrlf = 0;
 	int nlf = 0;
+	string encoding;
+	uint32_t entry = MessageIndex::npos;
+	size_t content_offset = SIZE_MAX;
+	size_t content_lines = 0;
+
+	nparts++;
+	handler.begin_part();
+
+	if (options.index) {
+		entry = options.index->entries.size();
+		IndexEntry index_entry{};
+		index_entry.parent = parent_entry;
+		index_entry.header_offset = offset;
+		options.index->entries.push_back(index_entry);
+	}
+
+	// Ends this part. If at_boundary, the last line read is the boundary of the parent.
+	auto end_part = [&](bool at_boundary) {
+		if (entry != MessageIndex::npos) {
+			size_t end = at_boundary ? line_offset : offset;
+			size_t lines = nlines - at_boundary;
+			if (content_offset == SIZE_MAX) {
+				content_offset = end;
+				content_lines = lines;
+			}
+			auto &index_entry = options.index->entries[entry];
+			index_entry.header_length = content_offset - index_entry.header_offset;
+			index_entry.body_offset = content_offset;
+			index_entry.body_length = end - content_offset;
+			index_entry.body_lines = lines - content_lines;
+			index_entry.content_type = get_value(content_type);
+			index_entry.transfer_encoding = get_value(encoding);
+		}
+		handler.end_part();
+	};
+
+	// The last header field is kept until we know it has no continuation lines.
+	auto emit_header = [&]{
+		if (field.empty())
+			return;
+		if (!have_content_type && streqi(field, "Content-Type")) {
+			content_type = value;
+			have_content_type = true;
+		}
+		if (encoding.empty() && streqi(field, "Content-Transfer-Encoding"))
+			encoding = value;
+		handler.header(field, value);
+		field.clear();
+		value.clear();
+	};
+
+	while (getline(line)) {
+		if (is_boundary(line, parent_boundary)) {
+			emit_header();
+			end_part(true);
+			last_line = move(line);
+			return true;
+		}
 
-	while (getline(in, line)) {
-		if (is_boundary(line, parent_boundary))
-			return line;
+		// Lines beyond the header size limit are not kept.
+		if (header_bytes + line.size() <= limits.max_header_bytes)
+			handler.header_line(line, !in.eof());
 
 		if (line.size() && line.back() == '\r') {
 			ncrlf++;
@@ -323,14 +645,26 @@ string Part::load(istream &in, const string &parent_boundary) {
 		if (line.empty())
 			break;
 
+		header_bytes += line.size();
+		if (header_bytes > limits.max_header_bytes) {
+			if (!limits.truncate)
+				return fail(ParseError::header_too_large, "header too large", line_offset, false);
+			result.truncated = true;
+			continue;
+		}
+
 		if (isspace(line[0])) {
-			if (headers.empty())
-				throw runtime_error("invalid header line");
-			headers.back().second.append(line);
+			if (field.empty()) {
+				if (!fail(ParseError::invalid_header, "invalid header line", line_offset, true))
+					return false;
+				continue;
+			}
+			value.append(line);
 			continue;
 		}
 
 		size_t colon = string::npos;
+		bool valid = true;
 
 		for (size_t i = 0; i < line.size(); ++i) {
 			if (line[i] == ':') {
@@ -339,224 +673,1073 @@ string Part::load(istream &in, const string &parent_boundary) {
 			}
 
 			if (line[i] < 33 || static_cast<uint8_t>(line[i]) > 127) {
-				if (i == 4 && line[i] == ' ' && line.compare(0, 4, "From") == 0 && headers.empty()) {
+				if (i == 4 && line[i] == ' ' && line.compare(0, 4, "From") == 0 && field.empty()) {
 					colon = i;
 					break;
 				}
-				throw runtime_error("invalid header line " +  line + std::to_string(i));
+				valid = false;
+				break;
 			}
 		}
 
-		if (colon == 0 || colon == string::npos)
-			throw runtime_error("invalid header line");
+		if (!valid || colon == 0 || colon == string::npos) {
+			if (!fail(ParseError::invalid_header, "invalid header line", line_offset, true))
+				return false;
+			continue;
+		}
 
+		// Skip the mbox From line.
 		if (line[colon] != ':')
 			continue;
 
+		emit_header();
+
 		auto start = colon + 1;
 		while (start < line.size() && isspace(line[start]))
 			start++;
 
 		// Empty header values are allowed for most fields.
 
-		auto field = line.substr(0, colon);
-		auto value = line.substr(start);
-
-		headers.emplace_back(field, value);
+		field.assign(line, 0, colon);
+		value.assign(line, start, string::npos);
 	}
 
-	crlf = ncrlf > nlf;
+	emit_header();
+	content_offset = offset;
+	content_lines = nlines;
 
-	const string content_type = get_header("Content-Type");
+	bool multipart = false;
+	string boundary;
 
 	if (types_match(get_value(content_type), "multipart")) {
 		boundary = get_parameter(content_type, "boundary");
-		if (boundary.empty())
-			throw runtime_error("multipart but no boundary specified");
-		multipart = true;
-	} else {
-		multipart = false;
+		if (boundary.empty()) {
+			if (!fail(ParseError::missing_boundary, "multipart but no boundary specified", offset, true))
+				return false;
+		} else if (depth >= limits.max_depth) {
+			if (!limits.truncate)
+				return fail(ParseError::too_deep, "multipart nested too deeply", offset, false);
+			result.truncated = true;
+		} else {
+			multipart = true;
+		}
 	}
 
+	handler.end_headers(ncrlf > nlf, multipart, boundary);
+
 	if (!multipart) {
-		while (getline(in, line)) {
-			if (is_boundary(line, parent_boundary))
-				return line;
+		size_t body_offset = offset;
+		size_t body_end = offset;
+		size_t limit = handler.body_limit();
+		bool complete = true;
+
+		// Binary bodies are kept as they are, but not the boundary after them.
+		bool binary = convert && types_match(get_value(encoding), "binary");
+		if (binary)
+			convert = false;
+
+		while (getline(line)) {
+			if (is_boundary(line, parent_boundary)) {
+				if (binary) {
+					convert = true;
+					convert_line(line);
+				}
+				handler.body_range(body_offset, body_end - body_offset, complete);
+				end_part(true);
+				last_line = move(line);
+				return true;
+			}
+
+			body_end = offset;
 			line.push_back('\n');
-			body.append(line);
+
+			// Skipped bytes do not count towards the limits.
+			if (line.size() > limit - min(limit, size)) {
+				complete = false;
+				if (size >= limit)
+					continue;
+				line.resize(limit - size);
+			}
+
+			if (!add_text(&Handler::body, line, size))
+				return false;
 		}
+
+		if (binary)
+			convert = true;
+		handler.body_range(body_offset, body_end - body_offset, complete);
 	} else {
-		while (getline(in, line)) {
-			if (is_boundary(line, parent_boundary))
-				return line;
-			if (is_boundary(line, boundary))
+		bool found = false;
+
+		while (getline(line)) {
+			if (is_boundary(line, parent_boundary)) {
+				end_part(true);
+				last_line = move(line);
+				return true;
+			}
+			if (is_boundary(line, boundary)) {
+				handler.delimiter(line, !in.eof());
+				found = true;
 				break;
+			}
 			line.push_back('\n');
-			preamble.append(line);
+			if (!add_text(&Handler::preamble, line, size))
+				return false;
 		}
 
-		while (true) {
-			parts.emplace_back();
-			string last_line = parts.back().load(in, boundary);
-			if (!is_boundary(last_line, boundary))
-				throw runtime_error("invalid boundary");
-			if (is_final_boundary(last_line, boundary))
+		if (!found && !in.bad()) {
+			if (!fail(ParseError::unterminated_multipart, "invalid boundary", offset, true))
+				return false;
+		}
+
+		while (found) {
+			if (nparts >= limits.max_parts) {
+				if (!limits.truncate)
+					return fail(ParseError::too_many_parts, "too many parts", line_offset, false);
+				result.truncated = true;
+
+				// Skip the remaining parts.
+				while (getline(line)) {
+					if (is_boundary(line, parent_boundary)) {
+						end_part(true);
+						last_line = move(line);
+						return true;
+					}
+					if (is_boundary(line, boundary) && is_final_boundary(line, boundary)) {
+						handler.delimiter(line, !in.eof());
+						break;
+					}
+				}
+
+				break;
+			}
+
+			string part_last_line;
+			if (!parse_part(boundary, part_last_line, depth + 1, entry))
+				return false;
+			if (!is_boundary(part_last_line, boundary)) {
+				if (!fail(ParseError::unterminated_multipart, "invalid boundary", offset, true))
+					return false;
+				break;
+			}
+			handler.delimiter(part_last_line, !in.eof());
+			if (is_final_boundary(part_last_line, boundary))
 				break;
 		}
 
-		while (getline(in, line)) {
-			if (is_boundary(line, parent_boundary))
-				return line;
+		size = 0;
+
+		while (getline(line)) {
+			if (is_boundary(line, parent_boundary)) {
+				end_part(true);
+				last_line = move(line);
+				return true;
+			}
 			line.push_back('\n');
-			epilogue.append(line);
+			if (!add_text(&Handler::epilogue, line, size))
+				return false;
 		}
 	}
 
 	if (in.bad())
-		throw runtime_error("error reading message");
+		return fail(ParseError::read_error, "error reading message", offset, false);
 
-	return {};
+	end_part(false);
+	return true;
 }
 
-void Part::save(ostream &out) const {
-	bool has_headers = false;
+// Builds a tree of Parts from the parser's output.
+// Large bodies are written to a temporary file as they are being parsed.
+class PartBuilder: public Parser::Handler {
+	Part &root;
+	const ParseOptions &options;
+	vector<Part *> stack;
+	int spill_fd;
+	string raw_header;
+	string raw_delimiter;
 
-	for (auto &header: headers) {
-		if (!header.second.empty()) {
-			out << header.first << ": " << header.second << ending[crlf];
-			has_headers = true;
-		}
+	void end_raw_header() {
+		if (raw_header.empty())
+			return;
+		stack.back()->raw_header = raw_header;
+		raw_header.clear();
 	}
 
-	if (message && !has_headers)
-		throw runtime_error("no headers specified");
+	void end_spill() {
+		auto part = stack.back();
+		int fd = spill_fd;
+		spill_fd = -1;
+		part->body_file = make_shared<BodyFile>(fd, false);
+	}
 
-	out << ending[crlf];
+	public:
+	PartBuilder(Part &root, const ParseOptions &options): root(root), options(options), stack(), spill_fd(-1) {}
 
-	if (parts.empty()) {
-		out << body;
-	} else {
-		out << preamble;
-		for (auto &part: parts) {
-			out << "--" << boundary << ending[crlf];
-			part.save(out);
+	~PartBuilder() {
+		// Keep whatever was parsed before an error.
+		if (spill_fd != -1) {
+			try {
+				end_spill();
+			} catch (...) {
+			}
 		}
-		out << "--" << boundary << "--" << ending[crlf];
-		out << epilogue;
 	}
-}
-
-void Part::load(const string &filename) {
-	ifstream in(filename);
-	if (!in.is_open())
-		throw runtime_error("could not open message file");
-	load(in);
-}
 
-void Part::save(const string &filename) const {
-	ofstream out(filename);
-	if (!out.is_open())
-		throw runtime_error("could not open message file");
-	save(out);
-	out.close();
-	if (out.fail())
-		throw runtime_error("could not write message file");
-}
+	void begin_part() override {
+		if (stack.empty()) {
+			stack.push_back(&root);
+		} else {
+			auto &parts = stack.back()->parts;
+			parts.emplace_back();
+			parts.back().raw_delimiter = move(raw_delimiter);
+			raw_delimiter.clear();
+			stack.push_back(&parts.back());
+		}
+	}
 
-void Part::from_string(const string &data) {
-	istringstream in(data);
-	load(in);
-}
+	void end_part() override {
+		end_raw_header();
+		if (spill_fd != -1)
+			end_spill();
+		stack.pop_back();
+	}
 
-string Part::to_string() const {
-	ostringstream out;
-	save(out);
-	return out.str();
-}
+	size_t body_limit() override {
+		return options.body_filter ? options.body_filter(*stack.back()) : SIZE_MAX;
+	}
 
-void Part::set_crlf(bool value) {
-	crlf = value;
-}
+	void body_range(size_t offset, size_t length, bool complete) override {
+		auto part = stack.back();
+		part->body_offset = offset;
+		part->body_length = length;
+		part->partial = !complete;
+	}
 
-// Low-level access
+	void header(string &field, string &value) override {
+		stack.back()->headers.emplace_back(move(field), move(value));
+	}
 
-string Part::get_body() const {
-	string result;
-	auto encoding = get_header_value("Content-Transfer-Encoding");
+	void header_line(const string &line, bool newline) override {
+		raw_header.append(line);
+		if (newline)
+			raw_header.push_back('\n');
+	}
 
-	if (streqi(encoding, "quoted-printable"))
-		result = quoted_printable_decode(body);
-	if (streqi(encoding, "base64"))
-		result = base64_decode(body);
-	else
-		result = body;
+	void delimiter(const string &line, bool newline) override {
+		auto part = stack.back();
+		raw_delimiter = line;
+		if (newline)
+			raw_delimiter.push_back('\n');
+		if (is_final_boundary(line, part->boundary)) {
+			part->raw_close = move(raw_delimiter);
+			raw_delimiter.clear();
+		}
+	}
 
-	if (is_mime_type("text")) {
-		auto charset = get_header_parameter("Content-Type", "charset");
-		if (!charset.empty() && !streqi(charset, "utf-8") && !streqi(charset, "us-ascii") && !streqi(charset, "ascii")) {
-			result = charset_decode(charset, result);
+	void end_headers(bool crlf, bool multipart, const string &boundary) override {
+		end_raw_header();
+		auto part = stack.back();
+		part->crlf = crlf;
+		part->multipart = multipart;
+		if (multipart)
+			part->boundary = boundary;
+
+		// Embedded messages are parsed later, but as if they were parsed now.
+		if (!multipart && part->is_mime_type("message/rfc822")) {
+			auto limits = make_shared<ParseLimits>(options.limits);
+			size_t depth = stack.size() - 1;
+			limits->max_depth = depth < limits->max_depth ? limits->max_depth - depth : 0;
+			part->embedded.set_limits(move(limits));
 		}
 	}
 
-	return result;
-}
+	void body(const string &line) override {
+		auto &body = stack.back()->body;
 
-string Part::get_preamble() const {
-	return preamble;
-}
+		if (spill_fd == -1 && body.size() + line.size() > options.spill_threshold) {
+			spill_fd = create_temporary_file(options.spill_directory);
+			write_fully(spill_fd, body.str().data(), body.size());
+			body.clear();
+		}
 
-string Part::get_epilogue() const {
-	return epilogue;
-}
+		if (spill_fd != -1)
+			write_fully(spill_fd, line.data(), line.size());
+		else
+			body.append(line);
+	}
 
-string Part::get_boundary() const {
-	return boundary;
-}
+	void preamble(const string &line) override {
+		stack.back()->preamble.append(line);
+	}
 
-vector<Part> &Part::get_parts() {
-	return parts;
-}
+	void epilogue(const string &line) override {
+		stack.back()->epilogue.append(line);
+	}
+};
 
-const vector<Part> &Part::get_parts() const {
-	return parts;
-}
+// Loading and saving a whole MIME message
 
-vector<pair<string, string>> &Part::get_headers() {
-	return headers;
-}
+string Part::load(istream &in, const string &parent_boundary) {
+	ParseOptions options;
+	PartBuilder builder(*this, options);
+	Parser parser(in, options, builder);
+	string last_line;
+
+	if (!parser.parse(parent_boundary, last_line))
+		throw runtime_error(parser.get_result().reason);
+
+	return last_line;
+}
+
+ParseResult Part::try_load(istream &in, const ParseOptions &options) noexcept {
+	PartBuilder builder(*this, options);
+	Parser parser(in, options, builder);
+	ParseResult result;
+
+	try {
+		string last_line;
+		parser.parse({}, last_line);
+		return parser.get_result();
+	} catch (bad_alloc &) {
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+	} catch (...) {
+		result.error = ParseError::read_error;
+		result.reason = "error reading message";
+	}
 
-const vector<pair<string, string>> &Part::get_headers() const {
-	return headers;
+	result.offset = parser.get_offset();
+	return result;
 }
 
-bool Part::is_multipart() const {
-	return multipart;
+ParseResult Part::try_load(const string &filename, const ParseOptions &options) noexcept {
+	try {
+		ifstream in(filename);
+		if (!in.is_open()) {
+			ParseResult result;
+			result.error = ParseError::read_error;
+			result.reason = "could not open message file";
+			return result;
+		}
+		if (options.index)
+			options.index->set_file(filename);
+		return try_load(in, options);
+	} catch (...) {
+		ParseResult result;
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+		return result;
+	}
 }
 
-bool Part::is_multipart(const std::string &subtype) const {
-	return multipart && get_header_value("Content-Type") == "multipart/" + subtype;
+ParseResult Part::try_from_string(const string &data, const ParseOptions &options) noexcept {
+	try {
+		istringstream in(data);
+		return try_load(in, options);
+	} catch (...) {
+		ParseResult result;
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+		return result;
+	}
 }
 
-bool Part::is_singlepart() const {
-	return !multipart;
-}
+// Serialization is written once, for any kind of output.
+// A writer is called with consecutive pieces of the message.
 
-bool Part::is_singlepart(const std::string &type) const {
-	return !multipart && types_match(get_header_value("Content-Type"), type);
-}
+static const string colon_space = ": ";
+static const string dashes = "--";
 
-bool Part::is_attachment() const {
-	return get_header_value("Content-Disposition") == "attachment";
-}
+namespace {
 
-bool Part::is_inline() const {
-	return get_header_value("Content-Disposition") == "inline";
-}
+// Finds the lines of header fields in the header as it was read.
+class RawHeader {
+	const string &raw;
+	size_t pos;
 
-void Part::set_body(const string &value) {
-	if (multipart)
-		throw runtime_error("Cannot set body of a multipart message");
+	// Like the parser, any whitespace starts a continuation line.
+	static bool is_continuation(char c) {
+		return c != '\r' && c != '\n' && isspace(static_cast<unsigned char>(c));
+	}
+
+	size_t line_end(size_t start) const {
+		size_t end = raw.find('\n', start);
+		return end == string::npos ? raw.size() : end + 1;
+	}
+
+	// Whether the field starting at start is parsed into field and value.
+	// The value is unfolded as by the parser.
+	bool matches(size_t start, size_t end, const string &field, const string &value) const {
+		// A field at the end of the input without a newline needs a new line ending.
+		if (raw[end - 1] != '\n')
+			return false;
+
+		if (raw.compare(start, field.size(), field) || end - start <= field.size() || raw[start + field.size()] != ':')
+			return false;
+
+		size_t matched = 0;
+		size_t pos = start + field.size() + 1;
+
+		while (pos < end) {
+			size_t eol = line_end(pos);
+			size_t stop = eol;
+			if (stop > pos && raw[stop - 1] == '\n')
+				stop--;
+			if (stop > pos && raw[stop - 1] == '\r')
+				stop--;
+
+			// Whitespace after the colon is not part of the value.
+			if (!matched && pos < stop && pos == start + field.size() + 1)
+				while (pos < stop && isspace(static_cast<unsigned char>(raw[pos])))
+					pos++;
+
+			size_t len = stop - pos;
+			if (value.compare(matched, len, raw, pos, len))
+				return false;
+			matched += len;
+			pos = eol;
+		}
+
+		return matched == value.size();
+	}
+
+	public:
+	explicit RawHeader(const string &raw): raw(raw), pos(0) {}
+
+	// Finds the next field with the given field and value, and returns the
+	// range of its lines. Fields that are skipped over were removed or changed.
+	bool find(const string &field, const string &value, size_t &start, size_t &end) {
+		for (size_t next = pos; next < raw.size();) {
+			size_t stop = line_end(next);
+			while (stop < raw.size() && is_continuation(raw[stop]))
+				stop = line_end(stop);
+
+			if (matches(next, stop, field, value)) {
+				start = next;
+				end = pos = stop;
+				return true;
+			}
+
+			next = stop;
+		}
+
+		return false;
+	}
+
+	// The empty line at the end of the header, if it was read.
+	bool find_end(size_t &start) const {
+		if (raw.empty() || raw.back() != '\n')
+			return false;
+		start = raw.size() - 1;
+		if (start && raw[start - 1] == '\r')
+			start--;
+		return !start || raw[start - 1] == '\n';
+	}
+};
+
+// Whether a delimiter line read from the input is valid for the given
+// boundary. Only whitespace may follow it, see RFC 2046 section 5.1.1.
+bool is_delimiter(const string &line, const string &boundary, bool close) {
+	if (line.empty() || line.back() != '\n' || !is_boundary(line, boundary))
+		return false;
+
+	size_t pos = 2 + boundary.size();
+	if (close) {
+		if (line.compare(pos, 2, "--"))
+			return false;
+		pos += 2;
+	}
+
+	for (; pos < line.size() - 1; pos++)
+		if (line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r')
+			return false;
+
+	return true;
+}
+
+}
+
+// Header fields that are unchanged are written as they were read, including
+// their folding. Consecutive unchanged lines are written in one piece.
+// If a filter is given, only the fields it accepts are written.
+template<typename Writer>
+void Part::write_header(Writer &out, const function<bool(const string &field)> &filter) const {
+	auto &raw = raw_header.str();
+	RawHeader original(raw);
+	size_t run_start = 0;
+	size_t run_end = 0;
+
+	auto flush = [&]{
+		if (run_end > run_start)
+			out(raw.data() + run_start, run_end - run_start);
+		run_start = run_end = 0;
+	};
+
+	for (auto &header: headers) {
+		if (filter && !filter(header.first))
+			continue;
+
+		// Fields with empty values are only kept if they were read that way.
+		size_t start, end;
+		if (original.find(header.first, header.second, start, end)) {
+			if (start != run_end)
+				flush();
+			if (run_end == run_start)
+				run_start = start;
+			run_end = end;
+			continue;
+		}
+
+		if (header.second.empty())
+			continue;
+
+		flush();
+		out(header.first);
+		out(colon_space);
+		out(header.second);
+		out(ending[crlf]);
+	}
+
+	size_t start;
+	if (original.find_end(start)) {
+		if (start != run_end)
+			flush();
+		if (run_end == run_start)
+			run_start = start;
+		run_end = raw.size();
+		flush();
+	} else {
+		flush();
+		out(ending[crlf]);
+	}
+}
+
+template<typename Writer>
+void Part::write_body(Writer &out) const {
+	if (parts.empty()) {
+		if (embedded.is_modified())
+			embedded.get()->write(out);
+		else if (body_file)
+			out(*body_file, ending[crlf]);
+		else
+			out(body);
+	} else {
+		out(preamble);
+		for (auto &part: parts) {
+			if (is_delimiter(part.raw_delimiter, boundary, false)) {
+				out(part.raw_delimiter);
+			} else {
+				out(dashes);
+				out(boundary);
+				out(ending[crlf]);
+			}
+			part.write(out);
+		}
+		if (is_delimiter(raw_close, boundary, true)) {
+			out(raw_close);
+		} else {
+			out(dashes);
+			out(boundary);
+			out(dashes);
+			out(ending[crlf]);
+		}
+		out(epilogue);
+	}
+}
+
+template<typename Writer>
+void Part::write(Writer &out) const {
+	if (message && is_headerless())
+		throw runtime_error("no headers specified");
+
+	write_header(out);
+	write_body(out);
+}
+
+namespace {
+
+struct stream_writer {
+	ostream &stream;
+
+	void operator()(const char *data, size_t len) {
+		stream.write(data, len);
+	}
+
+	void operator()(const string &str) {
+		stream.write(str.data(), str.size());
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		file.read_saved(ending, [&](const char *data, size_t len) {
+			stream.write(data, len);
+		});
+	}
+};
+
+struct size_writer {
+	size_t size;
+
+	void operator()(const char *, size_t len) {
+		size += len;
+	}
+
+	void operator()(const string &str) {
+		size += str.size();
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		size += file.get_saved_size(ending);
+	}
+};
+
+struct buffer_writer {
+	char *ptr;
+
+	void operator()(const char *data, size_t len) {
+		memcpy(ptr, data, len);
+		ptr += len;
+	}
+
+	void operator()(const string &str) {
+		memcpy(ptr, str.data(), str.size());
+		ptr += str.size();
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		file.read_saved(ending, [&](const char *data, size_t len) {
+			memcpy(ptr, data, len);
+			ptr += len;
+		});
+	}
+};
+
+// Collects pointers to the pieces of the message, and writes them in batches.
+struct fd_writer {
+	int fd;
+	size_t count;
+	struct iovec iov[IOV_MAX < 1024 ? IOV_MAX : 1024];
+
+	explicit fd_writer(int fd): fd(fd), count(0) {}
+
+	void operator()(const char *data, size_t len) {
+		if (!len)
+			return;
+		if (count == sizeof iov / sizeof *iov)
+			flush();
+		iov[count].iov_base = const_cast<char *>(data);
+		iov[count].iov_len = len;
+		count++;
+	}
+
+	void operator()(const string &str) {
+		(*this)(str.data(), str.size());
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		flush();
+		file.send(fd, ending);
+	}
+
+	void flush() {
+		struct iovec *next = iov;
+
+		while (count) {
+			ssize_t result = writev(fd, next, count);
+			if (result < 0) {
+				if (errno == EINTR)
+					continue;
+				throw runtime_error("could not write message");
+			}
+
+			size_t written = result;
+
+			// Skip over what has been written, which might be only part of an iovec.
+			while (count && written >= next->iov_len) {
+				written -= next->iov_len;
+				next++;
+				count--;
+			}
+
+			if (count) {
+				next->iov_base = static_cast<char *>(next->iov_base) + written;
+				next->iov_len -= written;
+			}
+		}
+	}
+};
+
+// Keeps only the bytes from offset up to offset + length, so skipped pieces are not copied.
+struct range_writer {
+	string &out;
+	size_t skip;
+	size_t left;
+
+	void append(const char *data, size_t len) {
+		if (skip >= len) {
+			skip -= len;
+			return;
+		}
+
+		data += skip;
+		len -= skip;
+		skip = 0;
+
+		len = min(len, left);
+		out.append(data, len);
+		left -= len;
+	}
+
+	void operator()(const char *data, size_t len) {
+		append(data, len);
+	}
+
+	void operator()(const string &str) {
+		append(str.data(), str.size());
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		if (!left)
+			return;
+
+		size_t size = file.get_saved_size(ending);
+		if (skip >= size) {
+			skip -= size;
+			return;
+		}
+
+		file.read_saved(ending, [&](const char *data, size_t len) {
+			append(data, len);
+		});
+	}
+};
+
+// Converts line endings to CRLF and optionally dot-stuffs lines, see RFC 5321
+// section 4.5.2. The output is collected in a buffer, which is passed on
+// whenever it is full and more output follows.
+struct smtp_writer {
+	const function<void(const char *data, size_t len, bool last)> &sink;
+	vector<char> buffer;
+	size_t fill;
+	bool dot_stuffing;
+	bool line_start;
+	bool cr;
+
+	smtp_writer(const function<void(const char *data, size_t len, bool last)> &sink, size_t size, bool dot_stuffing):
+		sink(sink), buffer(max(size, size_t(1))), fill(0), dot_stuffing(dot_stuffing), line_start(true), cr(false) {}
+
+	void put(const char *data, size_t len) {
+		while (len) {
+			if (fill == buffer.size()) {
+				sink(buffer.data(), fill, false);
+				fill = 0;
+			}
+			size_t n = min(len, buffer.size() - fill);
+			memcpy(buffer.data() + fill, data, n);
+			fill += n;
+			data += n;
+			len -= n;
+		}
+	}
+
+	void operator()(const char *data, size_t len) {
+		const char *end = data + len;
+
+		while (data < end) {
+			if (line_start && dot_stuffing && *data == '.')
+				put(".", 1);
+			line_start = false;
+
+			auto newline = static_cast<const char *>(memchr(data, '\n', end - data));
+			if (!newline) {
+				put(data, end - data);
+				cr = end[-1] == '\r';
+				return;
+			}
+
+			if (newline > data) {
+				put(data, newline - data);
+				cr = newline[-1] == '\r';
+			}
+
+			if (!cr)
+				put("\r", 1);
+			put("\n", 1);
+			cr = false;
+			line_start = true;
+			data = newline + 1;
+		}
+	}
+
+	void operator()(const string &str) {
+		(*this)(str.data(), str.size());
+	}
+
+	void operator()(const BodyFile &file, const string &ending) {
+		file.read_saved(ending, [&](const char *data, size_t len) {
+			(*this)(data, len);
+		});
+	}
+
+	// Ends the last line if necessary, and passes on the rest of the output.
+	void finish() {
+		if (!line_start) {
+			if (!cr)
+				put("\r", 1);
+			put("\n", 1);
+		}
+		if (dot_stuffing)
+			put(".\r\n", 3);
+		sink(buffer.data(), fill, true);
+	}
+};
+
+}
+
+bool Part::is_headerless() const {
+	for (auto &header: headers)
+		if (!header.second.empty())
+			return false;
+	return true;
+}
+
+void Part::write_range(string &out, bool with_header, bool with_body, size_t offset, size_t length, const function<bool(const string &field)> &filter) const {
+	range_writer writer{out, offset, length};
+	if (with_header)
+		write_header(writer, filter);
+	if (with_body && writer.left)
+		write_body(writer);
+}
+
+void Part::save(ostream &out) const {
+	stream_writer writer{out};
+	write(writer);
+}
+
+void Part::save(int fd) const {
+	fd_writer writer(fd);
+	write(writer);
+	writer.flush();
+}
+
+size_t Part::serialized_size() const {
+	size_writer writer{0};
+	write(writer);
+	return writer.size;
+}
+
+size_t Part::save_to_buffer(char *buffer) const {
+	buffer_writer writer{buffer};
+	write(writer);
+	return writer.ptr - buffer;
+}
+
+void Part::save_data(ostream &out) const {
+	function<void(const char *, size_t, bool)> sink = [&](const char *data, size_t len, bool) {
+		out.write(data, len);
+	};
+	smtp_writer writer(sink, 65536, true);
+	write(writer);
+	writer.finish();
+}
+
+void Part::save_data(int fd) const {
+	function<void(const char *, size_t, bool)> sink = [&](const char *data, size_t len, bool) {
+		write_fully(fd, data, len);
+	};
+	smtp_writer writer(sink, 65536, true);
+	write(writer);
+	writer.finish();
+}
+
+void Part::save_chunks(size_t chunk_size, const function<void(const char *data, size_t len, bool last)> &chunk) const {
+	smtp_writer writer(chunk, chunk_size, false);
+	write(writer);
+	writer.finish();
+}
+
+void Part::load(const string &filename) {
+	ifstream in(filename);
+	if (!in.is_open())
+		throw runtime_error("could not open message file");
+	load(in);
+}
+
+void Part::save(const string &filename) const {
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd == -1)
+		throw runtime_error("could not open message file");
+
+	try {
+		save(fd);
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+
+	if (close(fd))
+		throw runtime_error("could not write message file");
+}
+
+void Part::from_string(const string &data) {
+	istringstream in(data);
+	load(in);
+}
+
+string Part::to_string() const {
+	string result(serialized_size(), 0);
+	save_to_buffer(&result[0]);
+	return result;
+}
+
+void Part::set_crlf(bool value) {
+	if (value == crlf)
+		return;
+
+	crlf = value;
+	raw_header.clear();
+	raw_close.clear();
+	for (auto &part: parts)
+		part.raw_delimiter.clear();
+}
+
+static void convert_text(SharedString &text, bool crlf) {
+	if (!text.empty())
+		text = crlf ? lf_to_crlf(text.str()) : crlf_to_lf(text.str());
+}
+
+void Part::convert_line_endings(bool crlf) {
+	// The raw lines may use other line endings than the crlf flag says.
+	set_crlf(crlf);
+	raw_header.clear();
+	raw_close.clear();
+	for (auto &part: parts)
+		part.raw_delimiter.clear();
+
+	convert_text(preamble, crlf);
+	convert_text(epilogue, crlf);
+
+	if (!types_match(get_header_value("Content-Transfer-Encoding"), "binary")) {
+		if (embedded.is_modified()) {
+			embedded.modify().convert_line_endings(crlf);
+		} else {
+			convert_text(body, crlf);
+			embedded.reset();
+		}
+	}
+
+	for (auto &part: parts)
+		part.convert_line_endings(crlf);
+}
+
+// Low-level access
+
+// Decodes a raw body according to its transfer encoding and charset.
+static string decode_body(string_view raw, const string &encoding, const string &content_type) {
+	string result;
+
+	if (streqi(encoding, "quoted-printable"))
+		result = quoted_printable_decode(raw);
+	else if (streqi(encoding, "base64"))
+		result = base64_decode(raw);
+	else
+		result.assign(raw.data(), raw.size());
+
+	if (types_match(get_value(content_type), "text")) {
+		auto charset = get_parameter(content_type, "charset");
+		if (!charset.empty() && !streqi(charset, "utf-8") && !streqi(charset, "us-ascii") && !streqi(charset, "ascii")) {
+			result = charset_decode(charset, result);
+		}
+	}
+
+	return result;
+}
+
+string Part::get_body() const {
+	auto encoding = get_header_value("Content-Transfer-Encoding");
+
+	if (embedded.is_modified())
+		return decode_body(embedded.get()->to_string(), encoding, get_header("Content-Type"));
+
+	if (body_file) {
+		// Files that are encoded while saving contain the decoded body.
+		auto raw = body_file->read();
+		return decode_body(raw, body_file->is_base64() ? empty_string : encoding, get_header("Content-Type"));
+	}
+
+	return decode_body(body.str(), encoding, get_header("Content-Type"));
+}
+
+string Part::get_preamble() const {
+	return preamble;
+}
+
+string Part::get_epilogue() const {
+	return epilogue;
+}
+
+string Part::get_boundary() const {
+	return boundary;
+}
+
+vector<Part> &Part::get_parts() {
+	return parts;
+}
+
+const vector<Part> &Part::get_parts() const {
+	return parts;
+}
+
+vector<pair<string, string>> &Part::get_headers() {
+	return headers;
+}
+
+const vector<pair<string, string>> &Part::get_headers() const {
+	return headers;
+}
+
+bool Part::is_multipart() const {
+	return multipart;
+}
+
+bool Part::is_multipart(const std::string &subtype) const {
+	return multipart && get_header_value("Content-Type") == "multipart/" + subtype;
+}
+
+bool Part::is_singlepart() const {
+	return !multipart;
+}
+
+bool Part::is_singlepart(const std::string &type) const {
+	return !multipart && types_match(get_header_value("Content-Type"), type);
+}
+
+size_t Part::get_body_offset() const {
+	return body_offset;
+}
+
+size_t Part::get_body_length() const {
+	return body_length;
+}
+
+bool Part::is_partial() const {
+	return partial;
+}
+
+bool Part::is_attachment() const {
+	return get_header_value("Content-Disposition") == "attachment";
+}
+
+bool Part::is_inline() const {
+	return get_header_value("Content-Disposition") == "inline";
+}
+
+void Part::set_body(const string &value) {
+	if (multipart)
+		throw runtime_error("Cannot set body of a multipart message");
 	body = value;
+	body_file.reset();
+	embedded.reset();
+	partial = false;
 }
 
 void Part::set_preamble(const string &value) {
@@ -591,14 +1774,25 @@ void Part::clear() {
 	headers.clear();
 	preamble.clear();
 	body.clear();
+	body_file.reset();
+	embedded.reset();
 	epilogue.clear();
 	parts.clear();
 	boundary.clear();
+	raw_header.clear();
+	raw_delimiter.clear();
+	raw_close.clear();
+	body_offset = 0;
+	body_length = 0;
 	multipart = false;
+	partial = false;
 }
 
 void Part::clear_body() {
 	body.clear();
+	body_file.reset();
+	embedded.reset();
+	partial = false;
 }
 
 // Header manipulation
@@ -647,7 +1841,6 @@ const string &Part::operator[](const string &field) const {
 		if (iequals(header.first, field))
 			return header.second;
 
-	static string empty_string;
 	return empty_string;
 }
 
@@ -699,35 +1892,29 @@ void Part::set_header_parameter(const string &field, const string &parameter, co
 	append_header(field, "; " + parameter + "=" + value);
 }
 
-static string get_date_string(const chrono::system_clock::time_point &date = chrono::system_clock::now()) {
-	time_t t = chrono::system_clock::to_time_t(date);
-	struct tm tm{};
-	localtime_r(&t, &tm);
-	char str[128];
-	char *oldlocale = setlocale(LC_TIME, "C");
-	size_t result = strftime(str, sizeof str, "%a, %d %b %Y %T %z", &tm);
-	setlocale(LC_TIME, oldlocale);
-	if (result == 0)
-		throw runtime_error("Could not convert date to string");
-	return str;
-}
-
 void Part::add_received(const string &text, const chrono::system_clock::time_point &date) {
-	prepend_header("Received", text + "; " + get_date_string(date));
+	prepend_header("Received", text + "; " + date_format(date));
 }
 
 void Part::generate_msgid(const string &domain) {
 	auto now = chrono::system_clock::now();
 	uint64_t buf[3];
-	buf[0] = ((uint64_t)rnd() << 32) | rnd();
+	random_bytes(&buf[0], sizeof buf[0]);
 	buf[1] = chrono::duration_cast<chrono::microseconds>(now.time_since_epoch()).count();
-	buf[2] = ((uint64_t)rnd() << 32) | rnd();
+	random_bytes(&buf[2], sizeof buf[2]);
 	string msgid = "<" + base64_encode(string_view(reinterpret_cast<char *>(buf), sizeof buf)) + "@" + domain + ">";
 	set_header("Message-ID", msgid);
 }
 
 void Part::set_date(const chrono::system_clock::time_point &date) {
-	set_header("Date", get_date_string(date));
+	set_header("Date", date_format(date));
+}
+
+chrono::system_clock::time_point Part::get_date() const {
+	chrono::system_clock::time_point date{};
+	if (!date_parse(get_header("Date"), date))
+		return {};
+	return date;
 }
 
 // Part manipulation
@@ -767,12 +1954,20 @@ void Part::make_multipart(const string &subtype, const string &suggested_boundar
 		if (message)
 			set_header("MIME-Version", "1.0");
 
-		if (!body.empty()) {
+		if (has_body()) {
 			auto &part = append_part();
 			part.set_header("Content-Type", get_header("Content-Type"));
 			part.set_header("Content-Disposition", get_header("Content-Disposition"));
 			erase_header("Content-Disposition");
+			auto encoding = get_header("Content-Transfer-Encoding");
+			if (!encoding.empty()) {
+				part.set_header("Content-Transfer-Encoding", encoding);
+				erase_header("Content-Transfer-Encoding");
+			}
 			part.body = move(body);
+			part.body_file = move(body_file);
+			part.embedded = move(embedded);
+			embedded.reset();
 		}
 	}
 
@@ -802,6 +1997,13 @@ bool Part::flatten() {
 
 	if (part.multipart) {
 		parts = move(part.parts);
+	} else if (part.body_file || part.embedded.is_modified()) {
+		multipart = false;
+		set_header("Content-Transfer-Encoding", part.get_header("Content-Transfer-Encoding"));
+		body = move(part.body);
+		body_file = move(part.body_file);
+		embedded = move(part.embedded);
+		parts.clear();
 	} else {
 		multipart = false;
 		set_body(part.get_body());
@@ -829,24 +2031,57 @@ bool Part::has_mime_type() const {
 	return !get_mime_type().empty();
 }
 
-const Part *Part::get_first_matching_part(function<bool(const Part &)> predicate) const {
-	if (!multipart) {
-		if (headers.empty() && body.empty())
-			return nullptr;
-		if (is_attachment())
-			return nullptr;
-	}
+bool Part::is_empty() const {
+	return headers.empty() && !has_body();
+}
 
-	if (predicate(*this))
-		return this;
+bool Part::has_body() const {
+	return !body.empty() || body_file || embedded.is_modified();
+}
 
-	for (auto &part: parts) {
-		auto result = part.get_first_matching_part(predicate);
-		if (result)
-			return result;
-	}
+// The size of the body as it would be saved.
+size_t Part::get_saved_body_size() const {
+	if (embedded.is_modified())
+		return embedded.get()->serialized_size();
+	if (body_file)
+		return body_file->get_saved_size(ending[crlf]);
+	return body.size();
+}
+
+const Message *Part::get_message() const {
+	if (multipart || !is_mime_type("message/rfc822"))
+		return nullptr;
+
+	if (auto cached = embedded.get())
+		return cached.get();
+
+	ParseOptions options;
+	options.recover = true;
+
+	// The embedded message is one level deeper than this part.
+	if (auto limits = embedded.get_limits())
+		options.limits = *limits;
+	if (!options.limits.max_depth)
+		return nullptr;
+	options.limits.max_depth--;
+
+	auto parsed = make_shared<Message>();
+	if (body_file)
+		parsed->try_from_string(body_file->read(), options);
+	else
+		parsed->try_from_string(body, options);
+
+	return embedded.set(move(parsed)).get();
+}
+
+Message *Part::modify_message() {
+	if (!get_message())
+		return nullptr;
+	return &embedded.modify();
+}
 
-	return nullptr;
+const Part *Part::get_first_matching_part(function<bool(const Part &)> predicate) const {
+	return get_first_matching_part<function<bool(const Part &)> &>(predicate);
 }
 
 Part *Part::get_first_matching_part(function<bool(const Part &)> predicate) {
@@ -855,9 +2090,9 @@ Part *Part::get_first_matching_part(function<bool(const Part &)> predicate) {
 }
 
 const Part *Part::get_first_matching_part(const string &type) const {
-	return get_first_matching_part([type](const Part &part){
-			auto my_type = part.get_mime_type();
-			return types_match(my_type.empty() ? "text/plain" : my_type, type);
+	return get_first_matching_part([&type](const Part &part) {
+		auto my_type = get_value(part["Content-Type"]);
+		return types_match(my_type.empty() ? "text/plain" : my_type, type);
 	});
 }
 
@@ -880,7 +2115,7 @@ Part &Part::set_alternative(const string &subtype, const string &text) {
 
 	// Try to put it in the body first.
 	if (!multipart) {
-		if (body.empty() || is_mime_type(type)) {
+		if (!has_body() || is_mime_type(type)) {
 			part = this;
 		} else if (is_mime_type("text") && !is_attachment()) {
 			make_multipart("alternative");
@@ -946,33 +2181,36 @@ string Part::get_text() const {
 }
 
 Part &Part::attach(const Part &attachment) {
-	if (!multipart && body.empty()) {
-		if (attachment.message) {
-			set_header("Content-Type", "message/rfc822");
-			body = attachment.to_string();
-		} else {
-			set_header("Content-Type", attachment.get_header("Content-Type"));
-			body = attachment.body;
-		}
-		set_header("Content-Disposition", "attachment");
-		return *this;
+	Part *part = this;
+
+	if (multipart || has_body()) {
+		make_multipart("mixed");
+		part = &append_part();
 	}
 
-	make_multipart("mixed");
-	auto &part = append_part();
 	if (attachment.message) {
-		part.set_header("Content-Type", "message/rfc822");
-		part.body = attachment.to_string();
+		// The message is only serialized when the part is saved.
+		auto copy = make_shared<Message>();
+		static_cast<Part &>(*copy) = attachment;
+		part->set_header("Content-Type", "message/rfc822");
+		part->body.clear();
+		part->body_file.reset();
+		part->embedded.assign(move(copy));
 	} else {
-		part.set_header("Content-Type", attachment.get_header("Content-Type"));
-		part.body = attachment.body;
+		part->set_header("Content-Type", attachment.get_header("Content-Type"));
+		part->body = attachment.body;
+		part->embedded = attachment.embedded;
+		if (attachment.body_file || attachment.embedded.is_modified()) {
+			part->set_header("Content-Transfer-Encoding", attachment.get_header("Content-Transfer-Encoding"));
+			part->body_file = attachment.body_file;
+		}
 	}
-	part.set_header("Content-Disposition", "attachment");
-	return part;
+	part->set_header("Content-Disposition", "attachment");
+	return *part;
 }
 
 Part &Part::attach(const string &data, const string &type, const string &filename) {
-	if (!multipart && body.empty()) {
+	if (!multipart && !has_body()) {
 		set_header("Content-Type", type.empty() ? "text/plain" : type);
 		set_header("Content-Disposition", "attachment");
 		if (!filename.empty())
@@ -991,6 +2229,29 @@ Part &Part::attach(const string &data, const string &type, const string &filenam
 	return part;
 }
 
+Part &Part::attach_body_file(shared_ptr<const BodyFile> file, const string &type, const string &filename) {
+	auto &part = attach("", type, filename);
+	if (file->is_base64())
+		part.set_header("Content-Transfer-Encoding", "base64");
+	part.body_file = move(file);
+	return part;
+}
+
+// Message types must not be encoded, see RFC 2046 section 5.2.
+static bool needs_base64(const string &type) {
+	return !types_match(type, "message");
+}
+
+Part &Part::attach_file(const string &path, const string &type, const string &filename) {
+	auto file = make_shared<BodyFile>(path, needs_base64(type));
+	return attach_body_file(move(file), type, filename.empty() ? path.substr(path.rfind('/') + 1) : filename);
+}
+
+Part &Part::attach(int fd, const string &type, const string &filename) {
+	auto file = make_shared<BodyFile>(fcntl(fd, F_DUPFD_CLOEXEC, 0), needs_base64(type));
+	return attach_body_file(move(file), type, filename);
+}
+
 Part &Part::attach(istream &in, const string &type, const string &filename) {
 	auto &part = attach("", type, filename);
 	char buffer[4096];
@@ -1003,14 +2264,10 @@ Part &Part::attach(istream &in, const string &type, const string &filename) {
 vector<const Part *> Part::get_attachments() const {
 	vector<const Part *> attachments;
 
-	if (!multipart && get_header_value("Content-Disposition") == "attachment") {
-		attachments.push_back(this);
-		return attachments;
-	}
-
-	for (auto &part: parts) {
-		auto sub = part.get_attachments();
-		attachments.insert(end(attachments), begin(sub), end(sub));
+	for (auto &position: walk()) {
+		auto &part = position.get_part();
+		if (!part.multipart && part.get_header_value("Content-Disposition") == "attachment")
+			attachments.push_back(&part);
 	}
 
 	return attachments;
@@ -1024,7 +2281,7 @@ void Part::simplify() {
 		part.simplify();
 
 	parts.erase(remove_if(begin(parts), end(parts), [&](Part &part) {
-		return part.headers.empty() && part.body.empty();
+		return part.is_empty();
 	}), end(parts));
 
 	if (parts.empty()) {
@@ -1047,6 +2304,8 @@ void Part::clear_attachments() {
 				erase_header("Content-Type");
 				erase_header("Content-Disposition");
 				body.clear();
+				body_file.reset();
+				embedded.reset();
 			} else {
 				clear();
 			}
@@ -1095,14 +2354,60 @@ bool Part::has_html() const {
 }
 
 bool Part::has_attachments() const {
-	if (is_attachment())
-		return true;
+	return !visit([](const Part &part, size_t) {
+		return !part.is_attachment();
+	});
+}
 
-	for (auto &part: parts)
-		if (part.has_attachments())
-			return true;
+MessageSummary Part::summarize() const {
+	MessageSummary summary;
 
-	return false;
+	for (auto &position: walk()) {
+		auto &part = position.get_part();
+		summary.parts++;
+
+		if (part.multipart)
+			continue;
+
+		summary.body_size += part.get_saved_body_size();
+
+		auto &content_id = part["Content-ID"];
+		if (!content_id.empty()) {
+			auto id = get_value(content_id);
+			if (id.size() >= 2 && id.front() == '<' && id.back() == '>')
+				id = id.substr(1, id.size() - 2);
+			summary.content_ids.emplace_back(id, &part);
+		}
+
+		auto &content_type = part["Content-Type"];
+		auto type = get_value(content_type);
+
+		if (get_value(part["Content-Disposition"]) == "attachment") {
+			auto filename = get_parameter(part["Content-Disposition"], "filename");
+			if (filename.empty())
+				filename = get_parameter(content_type, "name");
+			summary.attachments.push_back({&part, try_decode_header(filename), type, part.get_saved_body_size()});
+			continue;
+		}
+
+		if (part.is_empty())
+			continue;
+
+		if (type.empty())
+			type = "text/plain";
+		if (!summary.plain && types_match(type, "text/plain"))
+			summary.plain = &part;
+		if (!summary.html && types_match(type, "text/html"))
+			summary.html = &part;
+	}
+
+	summary.subject = try_decode_header(get_header("Subject"));
+	summary.from = try_decode_header(get_header("From"));
+	summary.to = try_decode_header(get_header("To"));
+	summary.cc = try_decode_header(get_header("Cc"));
+	summary.message_id = get_header("Message-ID");
+	summary.date = get_date();
+	return summary;
 }
 
 // RFC2822 messages
@@ -1113,11 +2418,31 @@ Message::Message() {
 
 // Comparison
 
+// A body stored unencoded in a file is equal to the same body in memory.
+static bool bodies_equal(const string &lhs, const BodyFile *lhs_file, const string &rhs, const BodyFile *rhs_file) {
+	if (lhs_file == rhs_file)
+		return lhs == rhs;
+	if (lhs_file && rhs_file)
+		return *lhs_file == *rhs_file;
+	if (rhs_file)
+		return bodies_equal(rhs, rhs_file, lhs, lhs_file);
+	return !lhs_file->is_base64() && lhs_file->get_size() == rhs.size() && lhs_file->read() == rhs;
+}
+
 bool operator==(const Part &lhs, const Part &rhs) {
+	// A modified embedded message is compared as it would be saved.
+	auto saved_body = [](const Part &part) {
+		string out;
+		part.write_range(out, false, true, 0, SIZE_MAX);
+		return out;
+	};
+
+	bool modified = lhs.embedded.is_modified() || rhs.embedded.is_modified();
+
 	return lhs.crlf == rhs.crlf
 		&& lhs.multipart == rhs.multipart
 		&& lhs.preamble == rhs.preamble
-		&& lhs.body == rhs.body
+		&& (modified ? saved_body(lhs) == saved_body(rhs) : bodies_equal(lhs.body, lhs.body_file.get(), rhs.body, rhs.body_file.get()))
 		&& lhs.epilogue == rhs.epilogue
 		&& lhs.boundary == rhs.boundary
 		&& lhs.headers == rhs.headers
@@ -1128,4 +2453,610 @@ bool operator!=(const Part &lhs, const Part &rhs) {
 	return !(lhs == rhs);
 }
 
+// Streaming rewrite
+
+// Writes the parser's output as it arrives, after passing it through the rewriter's hooks.
+class RewriteHandler: public Parser::Handler {
+	struct Frame {
+		Part part;
+		RewriteAction action = RewriteAction::keep;
+		bool removed = false;  // whether this part or one of its ancestors is left out
+		bool started = false;  // whether the header has been handled
+	};
+
+	const Rewriter &rewriter;
+	ostream &out;
+	vector<Frame> stack;
+	string raw_header;
+	string delimiter_line;
+	string chunk;
+
+	void write(const string &str) {
+		out.write(str.data(), str.size());
+	}
+
+	void start_part() {
+		auto &frame = stack.back();
+		frame.started = true;
+		frame.part.raw_header = move(raw_header);
+		raw_header.clear();
+
+		if (!frame.removed && rewriter.header_hook)
+			frame.action = rewriter.header_hook(frame.part, stack.size() - 1);
+
+		if (frame.action == RewriteAction::remove)
+			frame.removed = true;
+		else if (frame.part.multipart || (frame.action == RewriteAction::filter && !rewriter.body_hook))
+			frame.action = RewriteAction::keep;
+
+		if (frame.removed) {
+			delimiter_line.clear();
+			return;
+		}
+
+		write(delimiter_line);
+		delimiter_line.clear();
+
+		stream_writer writer{out};
+		frame.part.write_header(writer);
+		if (frame.action == RewriteAction::replace)
+			frame.part.write_body(writer);
+	}
+
+	void filter(bool last) {
+		auto &frame = stack.back();
+		rewriter.body_hook(frame.part, chunk, last);
+		write(chunk);
+		chunk.clear();
+	}
+
+	public:
+	RewriteHandler(const Rewriter &rewriter, ostream &out): rewriter(rewriter), out(out), stack() {}
+
+	void begin_part() override {
+		bool removed = !stack.empty() && stack.back().removed;
+		stack.emplace_back();
+		stack.back().removed = removed;
+	}
+
+	void end_part() override {
+		// The header might have ended at a boundary or at the end of the input.
+		if (!stack.back().started)
+			start_part();
+
+		auto &frame = stack.back();
+		if (!frame.removed && frame.action == RewriteAction::filter)
+			filter(true);
+
+		stack.pop_back();
+	}
+
+	size_t body_limit() override {
+		auto &frame = stack.back();
+		bool copied = frame.action == RewriteAction::keep || frame.action == RewriteAction::filter;
+		return !frame.removed && copied ? SIZE_MAX : 0;
+	}
+
+	void header(string &field, string &value) override {
+		stack.back().part.headers.emplace_back(move(field), move(value));
+	}
+
+	void header_line(const string &line, bool newline) override {
+		raw_header.append(line);
+		if (newline)
+			raw_header.push_back('\n');
+	}
+
+	void delimiter(const string &line, bool newline) override {
+		auto &frame = stack.back();
+		if (frame.removed)
+			return;
+
+		if (is_final_boundary(line, frame.part.boundary)) {
+			write(line);
+			if (newline)
+				out.put('\n');
+		} else {
+			delimiter_line = line;
+			if (newline)
+				delimiter_line.push_back('\n');
+		}
+	}
+
+	void end_headers(bool crlf, bool multipart, const string &boundary) override {
+		auto &part = stack.back().part;
+		part.crlf = crlf;
+		part.multipart = multipart;
+		if (multipart)
+			part.boundary = boundary;
+		start_part();
+	}
+
+	void body(const string &line) override {
+		if (stack.back().action == RewriteAction::keep) {
+			write(line);
+			return;
+		}
+
+		chunk.append(line);
+		if (chunk.size() >= rewriter.chunk_size)
+			filter(false);
+	}
+
+	void preamble(const string &line) override {
+		if (!stack.back().removed)
+			write(line);
+	}
+
+	void epilogue(const string &line) override {
+		if (!stack.back().removed)
+			write(line);
+	}
+};
+
+namespace {
+
+// Stream buffers reading from and writing to file descriptors.
+class fd_istreambuf: public streambuf {
+	int fd;
+	vector<char> buffer;
+
+	int_type underflow() override {
+		ssize_t len;
+		do {
+			len = ::read(fd, buffer.data(), buffer.size());
+		} while (len < 0 && errno == EINTR);
+
+		if (len < 0)
+			throw runtime_error("could not read message");
+		if (len == 0)
+			return traits_type::eof();
+
+		setg(buffer.data(), buffer.data(), buffer.data() + len);
+		return traits_type::to_int_type(*gptr());
+	}
+
+	public:
+	explicit fd_istreambuf(int fd): fd(fd), buffer(65536) {}
+};
+
+class fd_ostreambuf: public streambuf {
+	int fd;
+	vector<char> buffer;
+
+	int_type overflow(int_type c) override {
+		sync();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override {
+		write_fully(fd, pbase(), pptr() - pbase());
+		setp(buffer.data(), buffer.data() + buffer.size());
+		return 0;
+	}
+
+	public:
+	explicit fd_ostreambuf(int fd): fd(fd), buffer(65536) {
+		setp(buffer.data(), buffer.data() + buffer.size());
+	}
+};
+
+}
+
+ParseResult Rewriter::rewrite(istream &in, ostream &out) const {
+	RewriteHandler handler(*this, out);
+	Parser parser(in, options, handler);
+	string last_line;
+
+	parser.parse({}, last_line);
+
+	out.flush();
+	if (!out)
+		throw runtime_error("could not write message");
+
+	return parser.get_result();
+}
+
+ParseResult Rewriter::rewrite(int in, int out) const {
+	fd_istreambuf in_buffer(in);
+	fd_ostreambuf out_buffer(out);
+	istream in_stream(&in_buffer);
+	ostream out_stream(&out_buffer);
+	return rewrite(in_stream, out_stream);
+}
+
+// Compact representation
+
+const uint32_t FlatMessage::npos;
+
+// Builds a FlatMessage from the parser's output.
+class FlatBuilder: public Parser::Handler {
+	FlatMessage &message;
+	const ParseOptions &options;
+	vector<uint32_t> stack;
+	vector<uint32_t> last_child;
+	unordered_map<string, FlatMessage::Span> fields;
+
+	void append(FlatMessage::Span &span, const string &str) {
+		if (message.text.size() + str.size() >= FlatMessage::npos)
+			throw length_error("message too large");
+		if (!span.size)
+			span.offset = message.text.size();
+		message.text.append(str);
+		span.size += str.size();
+	}
+
+	FlatMessage::Span store(const string &str) {
+		FlatMessage::Span span{0, 0};
+		append(span, str);
+		return span;
+	}
+
+	// Header field names are stored only once per message.
+	FlatMessage::Span intern(const string &field) {
+		auto it = fields.find(field);
+		if (it != fields.end())
+			return it->second;
+
+		auto span = store(field);
+		fields.emplace(field, span);
+		return span;
+	}
+
+	public:
+	FlatBuilder(FlatMessage &message, const ParseOptions &options): message(message), options(options), stack(), last_child(), fields() {}
+
+	void begin_part() override {
+		uint32_t index = message.nodes.size();
+		FlatMessage::Node node{};
+		node.parent = stack.empty() ? FlatMessage::npos : stack.back();
+		node.first_child = FlatMessage::npos;
+		node.next_sibling = FlatMessage::npos;
+		node.first_header = message.headers.size();
+		node.crlf = true;
+		message.nodes.push_back(node);
+
+		if (!stack.empty()) {
+			auto &last = last_child.back();
+			if (last == FlatMessage::npos)
+				message.nodes[stack.back()].first_child = index;
+			else
+				message.nodes[last].next_sibling = index;
+			last = index;
+		}
+
+		stack.push_back(index);
+		last_child.push_back(FlatMessage::npos);
+	}
+
+	void end_part() override {
+		stack.pop_back();
+		last_child.pop_back();
+	}
+
+	void header(string &field, string &value) override {
+		auto name = intern(field);
+		message.headers.push_back({name, store(value)});
+		message.nodes[stack.back()].header_count++;
+	}
+
+	size_t body_limit() override {
+		return options.body_filter ? options.body_filter(FlatPart(message, stack.back()).to_part()) : SIZE_MAX;
+	}
+
+	void end_headers(bool crlf, bool multipart, const string &boundary) override {
+		auto &node = message.nodes[stack.back()];
+		node.crlf = crlf;
+		node.multipart = multipart;
+		if (multipart)
+			node.boundary = store(boundary);
+	}
+
+	void body(const string &line) override {
+		append(message.nodes[stack.back()].body, line);
+	}
+
+	void preamble(const string &line) override {
+		append(message.nodes[stack.back()].preamble, line);
+	}
+
+	void epilogue(const string &line) override {
+		append(message.nodes[stack.back()].epilogue, line);
+	}
+};
+
+ParseResult FlatMessage::try_load(istream &in, const ParseOptions &options) noexcept {
+	clear();
+	FlatBuilder builder(*this, options);
+	Parser parser(in, options, builder);
+	ParseResult result;
+
+	try {
+		string last_line;
+		parser.parse({}, last_line);
+		return parser.get_result();
+	} catch (bad_alloc &) {
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+	} catch (length_error &) {
+		result.error = ParseError::message_too_large;
+		result.reason = "message too large";
+	} catch (...) {
+		result.error = ParseError::read_error;
+		result.reason = "error reading message";
+	}
+
+	result.offset = parser.get_offset();
+	return result;
+}
+
+ParseResult FlatMessage::try_load(const string &filename, const ParseOptions &options) noexcept {
+	try {
+		ifstream in(filename);
+		if (!in.is_open()) {
+			ParseResult result;
+			result.error = ParseError::read_error;
+			result.reason = "could not open message file";
+			return result;
+		}
+		if (options.index)
+			options.index->set_file(filename);
+		return try_load(in, options);
+	} catch (...) {
+		ParseResult result;
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+		return result;
+	}
+}
+
+ParseResult FlatMessage::try_from_string(const string &data, const ParseOptions &options) noexcept {
+	try {
+		istringstream in(data);
+		return try_load(in, options);
+	} catch (...) {
+		ParseResult result;
+		result.error = ParseError::out_of_memory;
+		result.reason = "out of memory";
+		return result;
+	}
+}
+
+void FlatMessage::load(const string &filename) {
+	auto result = try_load(filename);
+	if (!result)
+		throw runtime_error(result.reason);
+}
+
+void FlatMessage::from_string(const string &data) {
+	auto result = try_from_string(data);
+	if (!result)
+		throw runtime_error(result.reason);
+}
+
+string FlatMessage::get(const Span &span) const {
+	return text.substr(span.offset, span.size);
+}
+
+void FlatMessage::write(string &out, uint32_t index) const {
+	auto &node = nodes[index];
+	auto &end = ending[node.crlf];
+	bool has_headers = false;
+
+	for (uint32_t i = node.first_header; i < node.first_header + node.header_count; i++) {
+		auto &header = headers[i];
+		if (header.value.size) {
+			out.append(text, header.field.offset, header.field.size);
+			out.append(colon_space);
+			out.append(text, header.value.offset, header.value.size);
+			out.append(end);
+			has_headers = true;
+		}
+	}
+
+	if (!index && !has_headers)
+		throw runtime_error("no headers specified");
+
+	out.append(end);
+
+	if (node.first_child == npos) {
+		out.append(text, node.body.offset, node.body.size);
+		return;
+	}
+
+	out.append(text, node.preamble.offset, node.preamble.size);
+	for (auto child = node.first_child; child != npos; child = nodes[child].next_sibling) {
+		out.append(dashes);
+		out.append(text, node.boundary.offset, node.boundary.size);
+		out.append(end);
+		write(out, child);
+	}
+	out.append(dashes);
+	out.append(text, node.boundary.offset, node.boundary.size);
+	out.append(dashes);
+	out.append(end);
+	out.append(text, node.epilogue.offset, node.epilogue.size);
+}
+
+string FlatMessage::to_string() const {
+	string result;
+	if (nodes.empty())
+		return result;
+
+	result.reserve(text.size() + headers.size() * 4 + nodes.size() * 64);
+	write(result, 0);
+	return result;
+}
+
+Message FlatMessage::to_message() const {
+	Message msg;
+	if (!nodes.empty())
+		get_root().fill(msg);
+	return msg;
+}
+
+void FlatMessage::clear() {
+	text.clear();
+	nodes.clear();
+	headers.clear();
+}
+
+size_t FlatMessage::size() const {
+	return nodes.size();
+}
+
+bool FlatMessage::empty() const {
+	return nodes.empty();
+}
+
+FlatPart FlatMessage::get_root() const {
+	return FlatPart(*this, nodes.empty() ? npos : 0);
+}
+
+FlatPart FlatMessage::get_part(uint32_t index) const {
+	return FlatPart(*this, index < nodes.size() ? index : npos);
+}
+
+FlatPart::FlatPart(const FlatMessage &message, uint32_t index): message(&message), index(index) {}
+
+FlatPart::operator bool() const {
+	return index != FlatMessage::npos;
+}
+
+uint32_t FlatPart::get_index() const {
+	return index;
+}
+
+FlatPart FlatPart::get_parent() const {
+	return FlatPart(*message, message->nodes[index].parent);
+}
+
+FlatPart FlatPart::get_first_child() const {
+	return FlatPart(*message, message->nodes[index].first_child);
+}
+
+FlatPart FlatPart::get_next_sibling() const {
+	return FlatPart(*message, message->nodes[index].next_sibling);
+}
+
+vector<FlatPart> FlatPart::get_parts() const {
+	vector<FlatPart> result;
+	for (auto child = get_first_child(); child; child = child.get_next_sibling())
+		result.push_back(child);
+	return result;
+}
+
+string FlatPart::get_body() const {
+	auto &node = message->nodes[index];
+	string_view raw(message->text.data() + node.body.offset, node.body.size);
+	return decode_body(raw, get_header_value("Content-Transfer-Encoding"), get_header("Content-Type"));
+}
+
+string FlatPart::get_preamble() const {
+	return message->get(message->nodes[index].preamble);
+}
+
+string FlatPart::get_epilogue() const {
+	return message->get(message->nodes[index].epilogue);
+}
+
+string FlatPart::get_boundary() const {
+	return message->get(message->nodes[index].boundary);
+}
+
+vector<pair<string, string>> FlatPart::get_headers() const {
+	auto &node = message->nodes[index];
+	vector<pair<string, string>> result;
+	result.reserve(node.header_count);
+
+	for (uint32_t i = node.first_header; i < node.first_header + node.header_count; i++) {
+		auto &header = message->headers[i];
+		result.emplace_back(message->get(header.field), message->get(header.value));
+	}
+
+	return result;
+}
+
+bool FlatPart::is_multipart() const {
+	return message->nodes[index].multipart;
+}
+
+bool FlatPart::is_multipart(const string &subtype) const {
+	return is_multipart() && get_header_value("Content-Type") == "multipart/" + subtype;
+}
+
+bool FlatPart::is_singlepart() const {
+	return !is_multipart();
+}
+
+bool FlatPart::is_singlepart(const string &type) const {
+	return !is_multipart() && types_match(get_header_value("Content-Type"), type);
+}
+
+string FlatPart::get_header(const string &field) const {
+	auto &node = message->nodes[index];
+
+	for (uint32_t i = node.first_header; i < node.first_header + node.header_count; i++) {
+		auto &header = message->headers[i];
+		if (streqi(message->text, header.field.offset, header.field.size, field))
+			return message->get(header.value);
+	}
+
+	return {};
+}
+
+string FlatPart::get_header_value(const string &field) const {
+	return get_value(get_header(field));
+}
+
+string FlatPart::get_header_parameter(const string &field, const string &parameter) const {
+	return get_parameter(get_header(field), parameter);
+}
+
+string FlatPart::get_mime_type() const {
+	return get_header_value("Content-Type");
+}
+
+bool FlatPart::is_mime_type(const string &type) const {
+	return types_match(get_mime_type(), type);
+}
+
+bool FlatPart::is_attachment() const {
+	return get_header_value("Content-Disposition") == "attachment";
+}
+
+bool FlatPart::is_inline() const {
+	return get_header_value("Content-Disposition") == "inline";
+}
+
+void FlatPart::fill(Part &part) const {
+	auto &node = message->nodes[index];
+
+	part.headers = get_headers();
+	part.crlf = node.crlf;
+	part.multipart = node.multipart;
+	if (node.preamble.size)
+		part.preamble = get_preamble();
+	if (node.body.size)
+		part.body = message->get(node.body);
+	if (node.epilogue.size)
+		part.epilogue = get_epilogue();
+	part.boundary = get_boundary();
+
+	for (auto child = get_first_child(); child; child = child.get_next_sibling()) {
+		part.parts.emplace_back();
+		child.fill(part.parts.back());
+	}
+}
+
+Part FlatPart::to_part() const {
+	Part part;
+	fill(part);
+	return part;
+}
+
 }
@@ -18,23 +18,223 @@
 */
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 namespace Mimesis {
 
+class Part;
+class Message;
+class MessageIndex;
+
+enum class ParseError {
+	none,
+	invalid_header,
+	missing_boundary,
+	unterminated_multipart,
+	read_error,
+	out_of_memory,
+	too_deep,
+	too_many_parts,
+	header_too_large,
+	body_too_large,
+	message_too_large,
+	unterminated_data,
+};
+
+struct ParseLimits {
+	size_t max_depth = 100;              // nesting depth of multiparts
+	size_t max_parts = SIZE_MAX;         // number of parts, including the message itself
+	size_t max_header_bytes = SIZE_MAX;  // size of the header of a single part
+	size_t max_body_size = SIZE_MAX;     // size of a single body, preamble or epilogue
+	size_t max_total_size = SIZE_MAX;    // size of all bodies, preambles and epilogues together
+
+	// Truncate the message instead of stopping with an error. Nested
+	// multiparts that are too deep are kept as a single part, excess parts
+	// and header lines are skipped, and bodies are cut off.
+	bool truncate = false;
+};
+
+enum class LineEnding {
+	keep,
+	lf,
+	crlf,
+};
+
+struct ParseOptions {
+	// Skip invalid header lines, treat multiparts without a boundary as
+	// single parts, and close unterminated multiparts at the end of the input.
+	bool recover = false;
+
+	// Bodies larger than this are stored in a temporary file instead of in
+	// memory. The file is created in spill_directory, or in memory if empty.
+	size_t spill_threshold = SIZE_MAX;
+	std::string spill_directory;
+
+	// Called for each single part after its headers have been parsed, before
+	// its body is read. Returns how many bytes of the body to keep: SIZE_MAX
+	// to keep all of it, 0 to discard it. The rest of the body is skipped.
+	std::function<size_t(const Part &part)> body_filter;
+
+	// If set, the position of every part in the input is recorded in this index.
+	MessageIndex *index = nullptr;
+
+	// The input is the content of an SMTP DATA command, see RFC 5321 section
+	// 4.5.2. Leading dots are removed from lines, and parsing stops after the
+	// line with a single dot. Offsets refer to the input as it was received.
+	bool smtp_data = false;
+
+	// Converts all line endings while parsing, except in bodies with the
+	// binary transfer encoding. The parts then have their crlf flag set to match.
+	LineEnding line_ending = LineEnding::keep;
+
+	ParseLimits limits;
+};
+
+struct ParseResult {
+	ParseError error = ParseError::none;
+	size_t offset = 0;         // byte offset of the error in the input
+	const char *reason = "";
+	size_t recovered = 0;      // number of errors that were recovered from
+	bool truncated = false;    // whether a limit caused the message to be truncated
+	size_t bytes_read = 0;     // size of the input that was read, including an SMTP DATA terminator
+
+	explicit operator bool() const {
+		return error == ParseError::none;
+	}
+};
+
+class BodyFile;
+template<typename T> class PartWalk;
+
+struct AttachmentSummary {
+	const Part *part;
+	std::string filename;
+	std::string mime_type;
+	size_t size;  // size of the body as stored, before decoding
+};
+
+/* Everything needed to list or index a message, gathered in one walk.
+ * Bodies are not decoded; use get_body() on the parts that are needed.
+ */
+struct MessageSummary {
+	const Part *plain = nullptr;  // the part get_plain() would return
+	const Part *html = nullptr;   // the part get_html() would return
+	std::vector<AttachmentSummary> attachments;
+	std::vector<std::pair<std::string, const Part *>> content_ids;  // parts by Content-ID, without angle brackets
+	size_t parts = 0;             // number of parts, including the message itself
+	size_t body_size = 0;         // size of all bodies, as stored
+
+	// Headers, with encoded words decoded
+	std::string subject;
+	std::string from;
+	std::string to;
+	std::string cc;
+	std::string message_id;
+	std::chrono::system_clock::time_point date;
+};
+
+/* A reference counted string. Copies share the same data until one of them
+ * is modified, so copying a Part does not copy its bodies.
+ */
+class SharedString {
+	std::shared_ptr<std::string> data;
+
+	std::string &modify();
+
+	public:
+	SharedString() = default;
+	SharedString(const std::string &str);
+	SharedString(std::string &&str);
+	SharedString &operator=(const std::string &str);
+	SharedString &operator=(std::string &&str);
+
+	const std::string &str() const;
+	operator const std::string &() const { return str(); }
+	bool empty() const;
+	size_t size() const;
+
+	void append(const std::string &str);
+	void append(const char *buf, size_t len);
+	void clear();
+
+	friend bool operator==(const SharedString &lhs, const SharedString &rhs);
+};
+
+bool operator==(const SharedString &lhs, const SharedString &rhs);
+bool operator!=(const SharedString &lhs, const SharedString &rhs);
+
+/* The message embedded in a message/rfc822 part, parsed on first use. Copies
+ * share the parsed message until one of them modifies it.
+ */
+class MessageCache {
+	mutable std::shared_ptr<Message> message;
+	std::shared_ptr<const ParseLimits> limits;
+	bool modified = false;
+
+	public:
+	MessageCache() = default;
+	MessageCache(const MessageCache &other);
+	MessageCache(MessageCache &&other) = default;
+	MessageCache &operator=(const MessageCache &other);
+	MessageCache &operator=(MessageCache &&other) = default;
+
+	std::shared_ptr<Message> get() const;
+	std::shared_ptr<Message> set(std::shared_ptr<Message> parsed) const;
+	void assign(std::shared_ptr<Message> value);
+	Message &modify();
+	bool is_modified() const;
+	void reset();
+
+	// The limits of the message the part was parsed from, with max_depth
+	// reduced to what is left at the part. Defaults are used if not set.
+	void set_limits(std::shared_ptr<const ParseLimits> value);
+	const ParseLimits *get_limits() const;
+};
+
 class Part {
 	std::vector<std::pair<std::string, std::string>> headers;
-	std::string preamble;
-	std::string body;
-	std::string epilogue;
+	SharedString preamble;
+	SharedString body;
+	std::shared_ptr<const BodyFile> body_file;
+	MessageCache embedded;
+	SharedString epilogue;
 	std::vector<Part> parts;
 	std::string boundary;
+
+	// The header and delimiter lines as they were read. They are written
+	// instead of the parsed values as long as those are unchanged.
+	SharedString raw_header;
+	SharedString raw_delimiter;  // the delimiter line before this part
+	SharedString raw_close;      // the final delimiter line of a multipart
+
+	size_t body_offset;
+	size_t body_length;
 	bool multipart;
 	bool crlf;
+	bool partial;
+
+	friend class PartBuilder;
+	friend class FlatPart;
+	friend class RewriteHandler;
+
+	template<typename Writer> void write(Writer &out) const;
+	template<typename Writer> void write_header(Writer &out, const std::function<bool(const std::string &field)> &filter = nullptr) const;
+	template<typename Writer> void write_body(Writer &out) const;
+	void write_range(std::string &out, bool with_header, bool with_body, size_t offset, size_t length, const std::function<bool(const std::string &field)> &filter = nullptr) const;
+	bool is_headerless() const;
+	bool has_body() const;
+	size_t get_saved_body_size() const;
+	void write_bodystructure(std::string &out, bool extended) const;
+	bool is_empty() const;
+	Part &attach_body_file(std::shared_ptr<const BodyFile> file, const std::string &mime_type, const std::string &filename);
 
 	protected:
 	bool message;
@@ -49,8 +249,24 @@ class Part {
 	void load(const std::string &filename);
 	void save(std::ostream &out) const;
 	void save(const std::string &filename) const;
+	void save(int fd) const;
 	void from_string(const std::string &data);
 	std::string to_string() const;
+	size_t serialized_size() const;
+	size_t save_to_buffer(char *buffer) const;
+
+	// Saving for SMTP, with all line endings converted to CRLF. save_data()
+	// dot-stuffs lines and adds the terminating ".\r\n", for the DATA command.
+	// save_chunks() passes the message in chunks of chunk_size bytes, except
+	// for the last one, for the BDAT command.
+	void save_data(std::ostream &out) const;
+	void save_data(int fd) const;
+	void save_chunks(size_t chunk_size, const std::function<void(const char *data, size_t len, bool last)> &chunk) const;
+
+	// Loading without exceptions
+	ParseResult try_load(std::istream &in, const ParseOptions &options = {}) noexcept;
+	ParseResult try_load(const std::string &filename, const ParseOptions &options = {}) noexcept;
+	ParseResult try_from_string(const std::string &data, const ParseOptions &options = {}) noexcept;
 
 	// Low-level access
 	std::string get_body() const;
@@ -66,6 +282,12 @@ class Part {
 	bool is_singlepart() const;
 	bool is_singlepart(const std::string &type) const;
 
+	// The position of the body in the input it was loaded from, and whether
+	// only part of it was kept because of ParseOptions::body_filter.
+	size_t get_body_offset() const;
+	size_t get_body_length() const;
+	bool is_partial() const;
+
 	void set_body(const std::string &body);
 	void set_preamble(const std::string &preamble);
 	void set_epilogue(const std::string &epilogue);
@@ -97,6 +319,7 @@ class Part {
 	void add_received(const std::string &domain, const std::chrono::system_clock::time_point &date = std::chrono::system_clock::now());
 	void generate_msgid(const std::string &domain);
 	void set_date(const std::chrono::system_clock::time_point &date = std::chrono::system_clock::now());
+	std::chrono::system_clock::time_point get_date() const;
 
 	// Part manipulation
 	Part &append_part(const Part &part = {});
@@ -110,6 +333,13 @@ class Part {
 	bool is_mime_type(const std::string &type) const;
 	bool has_mime_type() const;
 
+	// The message in a message/rfc822 part, parsed on first use and cached, or
+	// nullptr for other parts. Reading it does not change how the part is
+	// saved. Through modify_message() it can be modified; the part is then
+	// saved with the modified message, until its body is replaced.
+	const Message *get_message() const;
+	Message *modify_message();
+
 	// Body and attachments
 	Part &set_alternative(const std::string &subtype, const std::string &text);
 	void set_plain(const std::string &text);
@@ -117,6 +347,10 @@ class Part {
 
 	const Part *get_first_matching_part(std::function<bool(const Part &)> predicate) const;
 	Part *get_first_matching_part(std::function<bool(const Part &)> predicate);
+	template<typename Predicate, typename = decltype(bool(std::declval<Predicate &>()(std::declval<const Part &>())))>
+	const Part *get_first_matching_part(Predicate &&predicate) const;
+	template<typename Predicate, typename = decltype(bool(std::declval<Predicate &>()(std::declval<const Part &>())))>
+	Part *get_first_matching_part(Predicate &&predicate);
 	const Part *get_first_matching_part(const std::string &type) const;
 	Part *get_first_matching_part(const std::string &type);
 	std::string get_first_matching_body(const std::string &type) const;
@@ -127,6 +361,8 @@ class Part {
 	Part &attach(const Part &attachment);
 	Part &attach(const std::string &data, const std::string &mime_type, const std::string &filename = {});
 	Part &attach(std::istream &in, const std::string &mime_type, const std::string &filename = {});
+	Part &attach(int fd, const std::string &mime_type, const std::string &filename = {});
+	Part &attach_file(const std::string &path, const std::string &mime_type, const std::string &filename = {});
 	std::vector<const Part *> get_attachments() const;
 
 	void clear_alternative(const std::string &subtype);
@@ -144,10 +380,232 @@ class Part {
 	bool is_attachment() const;
 	bool is_inline() const;
 
-	// Format manipulation
+	MessageSummary summarize() const;
+
+	// IMAP FETCH items, computed from the encoded bodies without decoding them
+	std::string get_bodystructure(bool extended = true) const;
+	std::string get_envelope() const;
+
+	// IMAP BODY[section]<offset.length>: the raw bytes of a section such as 1.2,
+	// 2.MIME, 3.HEADER, TEXT or HEADER.FIELDS (From To), as they would be saved.
+	// Messages in message/rfc822 parts are parsed when a section refers into them,
+	// see get_message().
+	// Returns an empty string if there is no such part.
+	std::string get_section(const std::string &section, size_t offset = 0, size_t length = SIZE_MAX) const;
+
+	// Format manipulation. Changing the line ending discards the original
+	// header and delimiter lines.
 	void set_crlf(bool value = true);
+
+	// Converts the line endings of the bodies, preambles and epilogues of this
+	// part and all its descendants, and sets their crlf flags. Bodies with the
+	// binary transfer encoding and bodies stored in files are left alone.
+	void convert_line_endings(bool crlf);
+
+	// Traversal
+	PartWalk<Part> walk();
+	PartWalk<const Part> walk() const;
+	template<typename Visitor> bool visit(Visitor &&visitor);
+	template<typename Visitor> bool visit(Visitor &&visitor) const;
+};
+
+/* A depth-first walk over a part and all its descendants, in the order they
+ * appear in the message. Each position gives the part, its depth below the
+ * part the walk started at, and its section number, such as 1.2 for the
+ * second child of the first child. Walking does not allocate, unless parts
+ * are nested deeper than inline_depth. Parts must not be added or removed
+ * during a walk.
+ */
+template<typename T>
+class PartWalk {
+	public:
+	class Position {
+		protected:
+		static const size_t inline_depth = 16;
+
+		struct Frame {
+			T *parent;
+			size_t index;
+		};
+
+		T *current;
+		size_t depth;
+		Frame frames[inline_depth];
+		std::vector<Frame> overflow;
+
+		Frame &frame(size_t level) {
+			return level < inline_depth ? frames[level] : overflow[level - inline_depth];
+		}
+
+		const Frame &frame(size_t level) const {
+			return level < inline_depth ? frames[level] : overflow[level - inline_depth];
+		}
+
+		explicit Position(T *current): current(current), depth(0), frames(), overflow() {}
+
+		public:
+		T &get_part() const {
+			return *current;
+		}
+
+		size_t get_depth() const {
+			return depth;
+		}
+
+		// The 1-based index of the part's ancestor at the given level, from 1 to depth.
+		size_t get_index(size_t level) const {
+			return frame(level - 1).index + 1;
+		}
+
+		std::string get_section() const {
+			std::string section;
+			for (size_t level = 1; level <= depth; level++) {
+				if (level > 1)
+					section.push_back('.');
+				section.append(std::to_string(get_index(level)));
+			}
+			return section;
+		}
+	};
+
+	class iterator: public Position {
+		using Position::current;
+		using Position::depth;
+		using Position::frames;
+		using Position::overflow;
+		using Position::inline_depth;
+
+		void push(T *parent) {
+			if (depth < inline_depth)
+				frames[depth] = {parent, 0};
+			else
+				overflow.push_back({parent, 0});
+			depth++;
+		}
+
+		void pop() {
+			depth--;
+			if (depth >= inline_depth)
+				overflow.pop_back();
+		}
+
+		public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Position;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Position *;
+		using reference = const Position &;
+
+		explicit iterator(T *root = nullptr): Position(root) {}
+
+		const Position &operator*() const {
+			return *this;
+		}
+
+		const Position *operator->() const {
+			return this;
+		}
+
+		iterator &operator++() {
+			auto &children = current->get_parts();
+			if (!children.empty()) {
+				push(current);
+				current = &children[0];
+				return *this;
+			}
+
+			while (depth) {
+				auto &top = this->frame(depth - 1);
+				auto &siblings = top.parent->get_parts();
+				if (++top.index < siblings.size()) {
+					current = &siblings[top.index];
+					return *this;
+				}
+				pop();
+			}
+
+			current = nullptr;
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator result = *this;
+			++*this;
+			return result;
+		}
+
+		bool operator==(const iterator &other) const {
+			return current == other.current;
+		}
+
+		bool operator!=(const iterator &other) const {
+			return current != other.current;
+		}
+	};
+
+	explicit PartWalk(T &root): root(&root) {}
+
+	iterator begin() const {
+		return iterator(root);
+	}
+
+	iterator end() const {
+		return iterator();
+	}
+
+	private:
+	T *root;
 };
 
+inline PartWalk<Part> Part::walk() {
+	return PartWalk<Part>(*this);
+}
+
+inline PartWalk<const Part> Part::walk() const {
+	return PartWalk<const Part>(*this);
+}
+
+// Calls visitor(part, depth) for each part in depth-first order, until it returns false.
+// Returns whether all parts have been visited.
+template<typename Visitor>
+bool Part::visit(Visitor &&visitor) {
+	for (auto &position: walk())
+		if (!visitor(position.get_part(), position.get_depth()))
+			return false;
+	return true;
+}
+
+template<typename Visitor>
+bool Part::visit(Visitor &&visitor) const {
+	for (auto &position: walk())
+		if (!visitor(position.get_part(), position.get_depth()))
+			return false;
+	return true;
+}
+
+// Returns the first part for which the predicate is true, skipping empty parts and attachments.
+template<typename Predicate, typename>
+const Part *Part::get_first_matching_part(Predicate &&predicate) const {
+	const Part *result = nullptr;
+
+	visit([&](const Part &part, size_t) {
+		if (!part.multipart && (part.is_empty() || part.is_attachment()))
+			return true;
+		if (!predicate(part))
+			return true;
+		result = &part;
+		return false;
+	});
+
+	return result;
+}
+
+template<typename Predicate, typename>
+Part *Part::get_first_matching_part(Predicate &&predicate) {
+	auto result = static_cast<const Part *>(this)->get_first_matching_part(std::forward<Predicate>(predicate));
+	return const_cast<Part *>(result);
+}
+
 class Message: public Part {
 	public:
 	Message();
@@ -156,6 +614,203 @@ class Message: public Part {
 bool operator==(const Part &lhs, const Part &rhs);
 bool operator!=(const Part &lhs, const Part &rhs);
 
+enum class RewriteAction {
+	keep,     // copy the body as it is
+	filter,   // pass the body through the body hook
+	replace,  // write the body set with set_body() in the header hook instead
+	remove,   // leave out the whole part, including its delimiter line
+};
+
+/* Copies a message from an input to an output while it is being parsed, so
+ * memory use does not depend on the size of the message, only on the size of
+ * its headers and longest line. For each part, the header hook can change the
+ * header and decide what happens to the body. Everything else is copied as it
+ * was read.
+ */
+class Rewriter {
+	public:
+	// Called after the header of each part has been read, with the depth of
+	// the part. Only the headers of the part are filled in, and changes to them
+	// are written. Multiparts can only be kept or removed.
+	std::function<RewriteAction(Part &part, size_t depth)> header_hook;
+
+	// Called with consecutive chunks of at least chunk_size bytes of the body
+	// of parts that are filtered, and with the rest of the body when last is
+	// set. The chunk can be changed in place.
+	std::function<void(const Part &part, std::string &chunk, bool last)> body_hook;
+	size_t chunk_size = 65536;
+
+	// The limits and recover option apply as when loading a message.
+	ParseOptions options;
+
+	// What has been read is written even if an error is returned. Exceptions
+	// from the hooks are passed on, and a runtime_error is thrown if the output
+	// could not be written.
+	ParseResult rewrite(std::istream &in, std::ostream &out) const;
+	ParseResult rewrite(int in, int out) const;
+};
+
+/* The position of a part in a stored message. The header includes the empty
+ * line that ends it. The body of a multipart includes all its children.
+ */
+struct IndexEntry {
+	uint32_t parent;  // index of the parent entry, or MessageIndex::npos
+	uint64_t header_offset;
+	uint64_t header_length;
+	uint64_t body_offset;
+	uint64_t body_length;
+	uint64_t body_lines;
+	std::string content_type;
+	std::string transfer_encoding;
+};
+
+/* An index of the parts of a stored message, filled in while parsing it with
+ * ParseOptions::index set. It can be saved next to the message, so sections
+ * can later be read without parsing the message again. The index is only
+ * valid as long as the message file has the same size and modification time.
+ */
+class MessageIndex {
+	public:
+	static const uint32_t npos = UINT32_MAX;
+	static const uint32_t version = 1;
+
+	std::vector<IndexEntry> entries;  // in the order the parts appear in the message
+	uint64_t file_size = 0;
+	int64_t file_mtime = 0;           // in nanoseconds
+
+	void set_file(const std::string &message_filename);
+	bool is_valid_for(const std::string &message_filename) const;
+
+	void save(const std::string &filename) const;
+	bool load(const std::string &filename, const std::string &message_filename);
+
+	// Sections are numbered like in IMAP, for example 1.2, or empty for the whole message.
+	const IndexEntry *find(const std::string &section) const;
+	std::string get_section(uint32_t entry) const;
+};
+
+// A range of bytes of a file, mapped into memory.
+class MappedRange {
+	void *map;
+	size_t map_size;
+	const char *start;
+	size_t length;
+
+	public:
+	MappedRange(const std::string &filename, uint64_t offset, uint64_t length);
+	~MappedRange();
+
+	MappedRange(const MappedRange &) = delete;
+	MappedRange &operator=(const MappedRange &) = delete;
+
+	const char *data() const;
+	size_t size() const;
+	std::string to_string() const;
+};
+
+class FlatMessage;
+
+/* A read-only view of one part of a FlatMessage, with the same accessors as
+ * Part. It is only valid as long as the FlatMessage it refers to.
+ */
+class FlatPart {
+	const FlatMessage *message;
+	uint32_t index;
+
+	friend class FlatMessage;
+
+	void fill(Part &part) const;
+
+	public:
+	FlatPart(const FlatMessage &message, uint32_t index);
+
+	explicit operator bool() const;
+	uint32_t get_index() const;
+	FlatPart get_parent() const;
+	FlatPart get_first_child() const;
+	FlatPart get_next_sibling() const;
+	std::vector<FlatPart> get_parts() const;
+
+	std::string get_body() const;
+	std::string get_preamble() const;
+	std::string get_epilogue() const;
+	std::string get_boundary() const;
+	std::vector<std::pair<std::string, std::string>> get_headers() const;
+	bool is_multipart() const;
+	bool is_multipart(const std::string &subtype) const;
+	bool is_singlepart() const;
+	bool is_singlepart(const std::string &type) const;
+
+	std::string get_header(const std::string &field) const;
+	std::string get_header_value(const std::string &field) const;
+	std::string get_header_parameter(const std::string &field, const std::string &parameter) const;
+	std::string get_mime_type() const;
+	bool is_mime_type(const std::string &type) const;
+	bool is_attachment() const;
+	bool is_inline() const;
+
+	Part to_part() const;
+};
+
+/* A message stored compactly: all parts are nodes in a single array, linked
+ * by indices, and all header fields, values and bodies are stored in a
+ * single buffer. Header field names are only stored once.
+ */
+class FlatMessage {
+	public:
+	static const uint32_t npos = UINT32_MAX;
+
+	private:
+	struct Span {
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct Header {
+		Span field;
+		Span value;
+	};
+
+	struct Node {
+		uint32_t parent;
+		uint32_t first_child;
+		uint32_t next_sibling;
+		uint32_t first_header;
+		uint32_t header_count;
+		Span preamble;
+		Span body;
+		Span epilogue;
+		Span boundary;
+		bool multipart;
+		bool crlf;
+	};
+
+	std::string text;
+	std::vector<Node> nodes;
+	std::vector<Header> headers;
+
+	friend class FlatBuilder;
+	friend class FlatPart;
+
+	std::string get(const Span &span) const;
+	void write(std::string &out, uint32_t index) const;
+
+	public:
+	void load(const std::string &filename);
+	void from_string(const std::string &data);
+	ParseResult try_load(std::istream &in, const ParseOptions &options = {}) noexcept;
+	ParseResult try_load(const std::string &filename, const ParseOptions &options = {}) noexcept;
+	ParseResult try_from_string(const std::string &data, const ParseOptions &options = {}) noexcept;
+	std::string to_string() const;
+	Message to_message() const;
+	void clear();
+
+	size_t size() const;
+	bool empty() const;
+	FlatPart get_root() const;
+	FlatPart get_part(uint32_t index) const;
+};
+
 }
 
 inline std::ostream &operator<<(std::ostream &out, const Mimesis::Part &part) {
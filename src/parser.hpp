@@ -0,0 +1,91 @@
+#pragma once
+
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+#include "mimesis.hpp"
+
+namespace Mimesis {
+
+/* The parser reads a message line by line, and reports its structure to a
+ * handler. The handler decides how to store the message.
+ */
+class Parser {
+	public:
+	class Handler {
+		public:
+		virtual ~Handler() = default;
+
+		// Called at the start of each part, nested parts are called in between.
+		virtual void begin_part() = 0;
+		virtual void end_part() = 0;
+
+		// Header fields and values may be moved from.
+		virtual void header(std::string &field, std::string &value) = 0;
+
+		// Called with each line of the header as it appears in the input,
+		// including the empty line that ends it, and with each boundary
+		// delimiter line. Newline tells whether the line ended with '\n'.
+		virtual void header_line(const std::string &line, bool newline) { (void)line; (void)newline; }
+		virtual void delimiter(const std::string &line, bool newline) { (void)line; (void)newline; }
+		virtual void end_headers(bool crlf, bool multipart, const std::string &boundary) = 0;
+
+		// Called after the headers of a single part. Returns how many bytes
+		// of its body to pass to body(), the rest is skipped.
+		virtual size_t body_limit() { return SIZE_MAX; }
+
+		// Called at the end of the body of a single part, with its position
+		// in the input, and whether all of it was passed to body().
+		virtual void body_range(size_t offset, size_t length, bool complete) { (void)offset; (void)length; (void)complete; }
+
+		// Lines include their line ending.
+		virtual void body(const std::string &line) = 0;
+		virtual void preamble(const std::string &line) = 0;
+		virtual void epilogue(const std::string &line) = 0;
+	};
+
+	Parser(std::istream &in, const ParseOptions &options, Handler &handler);
+
+	bool parse(const std::string &parent_boundary, std::string &last_line);
+	const ParseResult &get_result() const;
+	size_t get_offset() const;
+
+	private:
+	std::istream &in;
+	const ParseOptions &options;
+	Handler &handler;
+	ParseResult result;
+	size_t offset;
+	size_t line_offset;
+	size_t nlines;
+	size_t nparts;
+	size_t total_size;
+	bool terminated;
+	bool convert;
+
+	bool getline(std::string &line);
+	void convert_line(std::string &line);
+	bool fail(ParseError error, const char *reason, size_t offset, bool recoverable);
+	bool add_text(void (Handler::*add)(const std::string &), std::string &line, size_t &size);
+	bool parse_part(const std::string &parent_boundary, std::string &last_line, size_t depth, uint32_t parent_entry);
+};
+
+}
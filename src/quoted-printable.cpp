@@ -28,6 +28,14 @@ string quoted_printable_decode(string_view in) {
 
 	for (auto &&c: in) {
 		if (decode) {
+			// Soft line break
+			if (decode == 2 && c == '\r')
+				continue;
+			if (decode == 2 && c == '\n') {
+				decode = 0;
+				continue;
+			}
+
 			if (c >= '0' && c <= '9') {
 				val <<= 4;
 				val |= c - '0';
@@ -0,0 +1,136 @@
+/* Mimesis -- a library for parsing and creating RFC2822 messages
+   Copyright © 2017 Guus Sliepen <guus@lightbts.info>
+
+   Mimesis is free software; you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT
+   ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "random.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+#include <pthread.h>
+
+using namespace std;
+
+/* Each thread has its own ChaCha20 keystream, seeded once from
+ * std::random_device. This avoids a system call per random number, and
+ * avoids sharing a random_device between threads.
+ *
+ * A forked child would otherwise continue with the same keystream as its
+ * parent, so a fork bumps the generation counter, which forces a reseed.
+ */
+
+static atomic<unsigned int> fork_generation(1);
+
+static void on_fork() {
+	fork_generation++;
+}
+
+static inline uint32_t rotl(uint32_t x, int n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline void quarter_round(uint32_t *x, int a, int b, int c, int d) {
+	x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+	x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+	x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+	x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+}
+
+namespace {
+
+struct chacha20_state {
+	uint32_t input[16];
+	uint32_t output[16];
+	size_t used = sizeof output;
+	unsigned int generation = 0;
+
+	void seed() {
+		static const bool registered = pthread_atfork(nullptr, nullptr, on_fork) == 0;
+		(void)registered;
+
+		random_device rnd;
+
+		// "expand 32-byte k"
+		input[0] = 0x61707865;
+		input[1] = 0x3320646e;
+		input[2] = 0x79622d32;
+		input[3] = 0x6b206574;
+
+		for (int i = 4; i < 16; i++)
+			input[i] = rnd();
+
+		// Words 12 and 13 are the block counter.
+		input[12] = 0;
+		input[13] = 0;
+
+		used = sizeof output;
+		generation = fork_generation.load(memory_order_relaxed);
+	}
+
+	void refill() {
+		uint32_t x[16];
+		memcpy(x, input, sizeof x);
+
+		for (int i = 0; i < 10; i++) {
+			quarter_round(x, 0, 4,  8, 12);
+			quarter_round(x, 1, 5,  9, 13);
+			quarter_round(x, 2, 6, 10, 14);
+			quarter_round(x, 3, 7, 11, 15);
+			quarter_round(x, 0, 5, 10, 15);
+			quarter_round(x, 1, 6, 11, 12);
+			quarter_round(x, 2, 7,  8, 13);
+			quarter_round(x, 3, 4,  9, 14);
+		}
+
+		for (int i = 0; i < 16; i++)
+			output[i] = x[i] + input[i];
+
+		if (!++input[12])
+			input[13]++;
+
+		used = 0;
+	}
+
+	void get(void *buf, size_t len) {
+		if (generation != fork_generation.load(memory_order_relaxed))
+			seed();
+
+		auto out = static_cast<char *>(buf);
+
+		while (len) {
+			if (used == sizeof output)
+				refill();
+
+			size_t todo = min(len, sizeof output - used);
+			memcpy(out, reinterpret_cast<char *>(output) + used, todo);
+			// Don't keep used keystream around.
+			memset(reinterpret_cast<char *>(output) + used, 0, todo);
+			used += todo;
+			out += todo;
+			len -= todo;
+		}
+	}
+};
+
+}
+
+static thread_local chacha20_state state;
+
+void random_bytes(void *buf, size_t len) {
+	state.get(buf, len);
+}
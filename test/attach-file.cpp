@@ -0,0 +1,113 @@
+/* This tests attachments whose contents are read from a file while saving.
+ */
+
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string read_file(const string &filename) {
+	ifstream in(filename, ios::binary);
+	return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void check(const Mimesis::Message &msg, const string &data) {
+	string str = msg.to_string();
+	assert(str.size() == msg.serialized_size());
+
+	ostringstream out;
+	msg.save(out);
+	assert(out.str() == str);
+
+	vector<char> buf(msg.serialized_size());
+	assert(msg.save_to_buffer(buf.data()) == buf.size());
+	assert(string(buf.data(), buf.size()) == str);
+
+	msg.save("attach-file.out");
+	assert(read_file("attach-file.out") == str);
+
+	// The saved message must be indistinguishable from an in-memory attachment
+	Mimesis::Message msg2;
+	msg2.from_string(str);
+	auto attachments = msg2.get_attachments();
+	assert(attachments.size() == 1);
+	assert(attachments[0]->get_body() == data);
+}
+
+int main() {
+	string data;
+	for (int i = 0; i < 200000; i++)
+		data.push_back(static_cast<char>(i * 7 + i / 256));
+
+	// Attach by filename, with all sizes around a line and chunk boundary
+	for (size_t len: {0, 1, 2, 3, 56, 57, 58, 58367, 58368, 58369, 200000}) {
+		{
+			ofstream out("attach-file.tmp", ios::binary);
+			out << data.substr(0, len);
+		}
+
+		Mimesis::Message msg;
+		msg.set_header("Subject", "Attachment");
+		msg.set_plain("See attached file.\r\n");
+		auto &part = msg.attach_file("attach-file.tmp", "application/octet-stream");
+		assert(part.get_header_parameter("Content-Disposition", "filename") == "attach-file.tmp");
+		assert(part.get_body() == data.substr(0, len));
+		check(msg, data.substr(0, len));
+
+		Mimesis::Message copy = msg;
+		assert(copy == msg);
+	}
+
+	// Attach by file descriptor
+	{
+		int fd = open("attach-file.tmp", O_RDONLY);
+		assert(fd != -1);
+		Mimesis::Message msg;
+		msg.attach(fd, "application/octet-stream", "data.bin");
+		assert(close(fd) == 0);
+		check(msg, data);
+	}
+
+	// A message/rfc822 attachment is not encoded, and is sent as is
+	{
+		Mimesis::Message inner;
+		inner.set_header("Subject", "Inner");
+		inner.set_plain("Inner message.\r\n");
+		inner.save("attach-file.tmp");
+
+		Mimesis::Message msg;
+		msg.set_plain("Forwarded message.\r\n");
+		auto &part = msg.attach_file("attach-file.tmp", "message/rfc822", "inner.eml");
+		assert(part.get_header("Content-Transfer-Encoding").empty());
+		assert(part.get_body() == inner.to_string());
+
+		msg.save("attach-file.out");
+		Mimesis::Message msg2;
+		msg2.load("attach-file.out");
+		assert(msg2.get_attachments()[0]->get_body() == inner.to_string());
+	}
+
+	// Non-regular files are refused
+	{
+		Mimesis::Message msg;
+		bool thrown = false;
+		try {
+			msg.attach_file("/dev/null", "application/octet-stream");
+		} catch (runtime_error &) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+
+	unlink("attach-file.tmp");
+	unlink("attach-file.out");
+}
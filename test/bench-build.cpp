@@ -0,0 +1,49 @@
+/* This benchmarks building messages using the high-level functions.
+ * Each message gets a Message-ID, a Date and two multipart boundaries.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static double seconds_since(const chrono::steady_clock::time_point &start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	long iterations = argc > 1 ? atol(argv[1]) : 100000;
+	size_t bytes = 0;
+
+	// Message-IDs only
+	{
+		Mimesis::Message msg;
+		auto start = chrono::steady_clock::now();
+		for (long i = 0; i < iterations; i++)
+			msg.generate_msgid("example.org");
+		auto elapsed = seconds_since(start);
+		cout << "generate_msgid: " << iterations / elapsed << " Message-IDs/s\n";
+	}
+
+	// Complete messages
+	{
+		auto start = chrono::steady_clock::now();
+		for (long i = 0; i < iterations; i++) {
+			Mimesis::Message msg;
+			msg["From"] = "Some One <some.one@example.org>";
+			msg["To"] = "Someone Else <someone.else@example.org>";
+			msg["Subject"] = "Test";
+			msg.generate_msgid("example.org");
+			msg.set_date();
+			msg.set_plain("Hello!\r\n");
+			msg.set_html("<p>Hello!</p>\r\n");
+			msg.attach("This is the attachment.\r\n", "text/plain", "attachment.txt");
+			bytes += msg.to_string().size();
+		}
+		auto elapsed = seconds_since(start);
+		cout << "build: " << iterations / elapsed << " messages/s, " << bytes / elapsed / 1e6 << " MB/s\n";
+	}
+}
@@ -0,0 +1,241 @@
+/* This benchmarks loading, saving and decoding a synthetic corpus of messages.
+ * For each operation it reports the throughput and the number of memory
+ * allocations per message.
+ *
+ * The corpus can be changed using options of the form --name=value:
+ * messages, size, depth, parts, headers, encodings, charset, seed and rounds.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+#include "base64.hpp"
+#include "charset.hpp"
+#include "line-ending.hpp"
+#include "quoted-printable.hpp"
+#include "corpus.hpp"
+
+using namespace std;
+
+static atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+	allocations++;
+	if (void *ptr = malloc(size ? size : 1))
+		return ptr;
+	throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+static int rounds = 5;
+
+static void bench(const string &name, size_t messages, size_t bytes, const function<void()> &func) {
+	size_t before = allocations;
+	auto start = chrono::steady_clock::now();
+
+	for (int i = 0; i < rounds; i++)
+		func();
+
+	auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	size_t allocated = allocations - before;
+
+	cout << name << ": "
+		<< rounds * bytes / elapsed / 1e6 << " MB/s, "
+		<< rounds * messages / elapsed << " messages/s, "
+		<< double(allocated) / (rounds * messages) << " allocations/message\n";
+}
+
+static void collect_leaves(const Mimesis::Part &part, vector<const Mimesis::Part *> &leaves) {
+	if (!part.is_multipart())
+		leaves.push_back(&part);
+
+	for (auto &child: part.get_parts())
+		collect_leaves(child, leaves);
+}
+
+static vector<string> split(const string &str) {
+	vector<string> result;
+	stringstream ss(str);
+	string item;
+	while (getline(ss, item, ','))
+		result.push_back(item);
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	Corpus::Options options;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") || eq == string::npos) {
+			cerr << "Invalid argument " << arg << "\n";
+			return 1;
+		}
+
+		auto name = arg.substr(2, eq - 2);
+		auto value = arg.substr(eq + 1);
+
+		if (name == "messages")
+			options.messages = strtoul(value.c_str(), nullptr, 10);
+		else if (name == "size")
+			options.body_size = strtoul(value.c_str(), nullptr, 10);
+		else if (name == "depth")
+			options.depth = atoi(value.c_str());
+		else if (name == "parts")
+			options.parts = atoi(value.c_str());
+		else if (name == "headers")
+			options.headers = atoi(value.c_str());
+		else if (name == "encodings")
+			options.encodings = split(value);
+		else if (name == "charset")
+			options.charset = value;
+		else if (name == "seed")
+			options.seed = strtoull(value.c_str(), nullptr, 10);
+		else if (name == "rounds")
+			rounds = atoi(value.c_str());
+		else {
+			cerr << "Unknown option " << name << "\n";
+			return 1;
+		}
+	}
+
+	if (options.encodings.empty() || options.parts == 0 || rounds <= 0) {
+		cerr << "Invalid options\n";
+		return 1;
+	}
+
+	Corpus::Generator generator(options);
+	auto corpus = generator.corpus();
+	size_t n = corpus.size();
+
+	size_t corpus_bytes = 0;
+	for (auto &str: corpus)
+		corpus_bytes += str.size();
+
+	cout << "Corpus: " << n << " messages, " << corpus_bytes << " bytes\n";
+
+	vector<Mimesis::Message> messages(n);
+	bench("load", n, corpus_bytes, [&]{
+		for (size_t i = 0; i < n; i++) {
+			messages[i].clear();
+			messages[i].from_string(corpus[i]);
+		}
+	});
+
+	vector<Mimesis::FlatMessage> flat_messages(n);
+	bench("load flat", n, corpus_bytes, [&]{
+		for (size_t i = 0; i < n; i++)
+			flat_messages[i].from_string(corpus[i]);
+	});
+
+	bench("save", n, corpus_bytes, [&]{
+		for (size_t i = 0; i < n; i++)
+			if (messages[i].to_string() != corpus[i])
+				abort();
+	});
+
+	// Copies share their bodies, so only the headers and structure are copied.
+	bench("copy", n, corpus_bytes, [&]{
+		for (auto &msg: messages) {
+			Mimesis::Message copy = msg;
+			copy.set_header("To", "someone@example.org");
+		}
+	});
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	bench("save to fd", n, corpus_bytes, [&]{
+		for (auto &msg: messages)
+			msg.save(null_fd);
+	});
+
+	bench("save for SMTP", n, corpus_bytes, [&]{
+		for (auto &msg: messages)
+			msg.save_data(null_fd);
+	});
+	close(null_fd);
+
+	// Streams each message from input to output, adding a header on the way.
+	Mimesis::Rewriter rewriter;
+	rewriter.header_hook = [](Mimesis::Part &part, size_t depth) {
+		if (!depth)
+			part.prepend_header("X-Rewritten", "yes");
+		return Mimesis::RewriteAction::keep;
+	};
+	bench("rewrite", n, corpus_bytes, [&]{
+		for (auto &str: corpus) {
+			istringstream in(str);
+			ostringstream out;
+			rewriter.rewrite(in, out);
+		}
+	});
+
+	vector<const Mimesis::Part *> leaves;
+	for (auto &msg: messages)
+		collect_leaves(msg, leaves);
+
+	size_t decoded_bytes = 0;
+	for (auto leaf: leaves)
+		decoded_bytes += leaf->get_body().size();
+
+	bench("get_body", n, decoded_bytes, [&]{
+		for (auto leaf: leaves)
+			leaf->get_body();
+	});
+
+	bench("get_attachments", n, corpus_bytes, [&]{
+		for (auto &msg: messages)
+			msg.get_attachments();
+	});
+
+	// Codecs, on the whole corpus
+	string all;
+	for (auto &str: corpus)
+		all.append(str);
+
+	string base64 = base64_encode(all);
+	bench("base64_encode", n, all.size(), [&]{
+		base64_encode(all);
+	});
+
+	bench("base64_decode", n, base64.size(), [&]{
+		base64_decode(base64);
+	});
+
+	string quoted_printable = Corpus::Generator::quoted_printable(all);
+	bench("quoted_printable_decode", n, quoted_printable.size(), [&]{
+		quoted_printable_decode(quoted_printable);
+	});
+
+	bench("crlf_to_lf", n, all.size(), [&]{
+		crlf_to_lf(all);
+	});
+
+	string lf = crlf_to_lf(all);
+	bench("lf_to_crlf", n, lf.size(), [&]{
+		lf_to_crlf(lf);
+	});
+
+	bench("charset_decode", n, all.size(), [&]{
+		charset_decode(options.charset, all);
+	});
+}
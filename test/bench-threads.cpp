@@ -0,0 +1,67 @@
+/* This benchmarks parsing and building messages from multiple threads,
+ * and shows how the throughput scales with the number of threads.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string build(int i) {
+	Mimesis::Message msg;
+	msg["From"] = "Some One <some.one@example.org>";
+	msg["To"] = "Someone Else <someone.else@example.org>";
+	msg["Subject"] = "Test " + to_string(i);
+	msg.generate_msgid("example.org");
+	msg.set_date();
+	msg.set_plain("Hello!\r\n");
+	msg.set_html("<p>Hello!</p>\r\n");
+	msg.attach(string(4094, 'x') + "\r\n", "application/octet-stream", "attachment.bin");
+	return msg.to_string();
+}
+
+static void worker(long iterations, size_t &bytes) {
+	for (long i = 0; i < iterations; i++) {
+		auto str = build(i);
+		Mimesis::Message msg;
+		msg.from_string(str);
+		msg.add_received("by localhost");
+		bytes += msg.get_plain().size() + msg.get_attachments().size() + msg.to_string().size();
+	}
+}
+
+int main(int argc, char *argv[]) {
+	long iterations = argc > 1 ? atol(argv[1]) : 20000;
+	unsigned int max_threads = argc > 2 ? atoi(argv[2]) : thread::hardware_concurrency();
+	if (!max_threads)
+		max_threads = 1;
+
+	double base = 0;
+
+	for (unsigned int nthreads = 1;; nthreads = min(nthreads * 2, max_threads)) {
+		vector<thread> threads;
+		vector<size_t> bytes(nthreads);
+
+		auto start = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < nthreads; i++)
+			threads.emplace_back(worker, iterations, ref(bytes[i]));
+		for (auto &thread: threads)
+			thread.join();
+		auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		double rate = nthreads * iterations / elapsed;
+		if (nthreads == 1)
+			base = rate;
+
+		cout << nthreads << " threads: " << rate << " messages/s, speedup " << rate / base << "\n";
+
+		if (nthreads == max_threads)
+			break;
+	}
+}
@@ -0,0 +1,80 @@
+/* This tests skipping and truncating bodies while parsing. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	string data;
+	for (int i = 0; data.size() < 100000; i++)
+		data += "Line " + to_string(i) + "\r\n";
+
+	Mimesis::Message orig;
+	orig.set_header("Subject", "Preview");
+	orig.set_plain("plain text\r\n");
+	orig.set_html("<p>html text</p>\r\n");
+	orig.attach(data, "text/csv", "data.csv");
+	auto str = orig.to_string();
+
+	Mimesis::Message full;
+	full.from_string(str);
+
+	Mimesis::ParseOptions options;
+	options.body_filter = [](const Mimesis::Part &part) -> size_t {
+		assert(part.get_body().empty());
+		if (part.is_attachment())
+			return 0;
+		if (part.is_mime_type("text/html"))
+			return 5;
+		return SIZE_MAX;
+	};
+
+	// Skipped bytes do not count towards the limits
+	options.limits.max_total_size = 1000;
+
+	Mimesis::Message msg;
+	assert(msg.try_from_string(str, options));
+
+	auto plain = msg.get_first_matching_part("text/plain");
+	assert(plain->get_body() == "plain text\r\n");
+	assert(!plain->is_partial());
+
+	auto html = msg.get_first_matching_part("text/html");
+	assert(html->get_body() == "<p>ht");
+	assert(html->is_partial());
+
+	auto attachment = msg.get_attachments()[0];
+	assert(attachment->get_body().empty());
+	assert(attachment->is_partial());
+	assert(attachment->get_header_parameter("Content-Disposition", "filename") == "data.csv");
+
+	// The offsets point to the bodies in the original input
+	auto full_plain = full.get_first_matching_part("text/plain");
+	auto full_html = full.get_first_matching_part("text/html");
+	auto full_attachment = full.get_attachments()[0];
+	assert(plain->get_body_offset() == full_plain->get_body_offset());
+	assert(str.substr(plain->get_body_offset(), plain->get_body_length()) == full_plain->get_body());
+	assert(str.substr(html->get_body_offset(), html->get_body_length()) == full_html->get_body());
+	assert(str.substr(attachment->get_body_offset(), attachment->get_body_length()) == full_attachment->get_body());
+	assert(!full_attachment->is_partial());
+
+	// Setting a body makes it complete again
+	Mimesis::Message copy = msg;
+	copy.get_parts()[1].set_body("replaced\r\n");
+	assert(!copy.get_parts()[1].is_partial());
+
+	// The compact representation applies the same filter
+	Mimesis::FlatMessage flat;
+	assert(flat.try_from_string(str, options));
+	size_t attachments = 0;
+	for (auto part = flat.get_root().get_first_child(); part; part = part.get_next_sibling()) {
+		if (part.is_attachment()) {
+			assert(part.get_body().empty());
+			attachments++;
+		}
+	}
+	assert(attachments == 1);
+}
@@ -0,0 +1,65 @@
+/* This tests the base64, quoted-printable and character set codecs. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+#include "base64.hpp"
+#include "charset.hpp"
+#include "quoted-printable.hpp"
+
+using namespace std;
+
+int main() {
+	// Base64, including padding
+	assert(base64_encode("") == "");
+	assert(base64_encode("f") == "Zg==");
+	assert(base64_encode("fo") == "Zm8=");
+	assert(base64_encode("foo") == "Zm9v");
+	assert(base64_encode("foob") == "Zm9vYg==");
+	assert(base64_encode("fooba") == "Zm9vYmE=");
+	assert(base64_encode("foobar") == "Zm9vYmFy");
+
+	for (size_t len = 0; len < 64; len++) {
+		string data;
+		for (size_t i = 0; i < len; i++)
+			data.push_back(static_cast<char>(i * 37));
+		assert(base64_decode(base64_encode(data)) == data);
+	}
+
+	assert(base64_decode("Zm9v\r\nYmFy\r\n") == "foobar");
+
+	// Quoted-printable, including soft line breaks
+	assert(quoted_printable_decode("caf=E9") == "caf\xe9");
+	assert(quoted_printable_decode("a=3Db") == "a=b");
+	assert(quoted_printable_decode("soft=\r\nbreak\r\n") == "softbreak\r\n");
+	assert(quoted_printable_decode("soft=\nbreak\n") == "softbreak\n");
+
+	// Character sets
+	assert(charset_decode(" ISO-8859-1 ", "caf\xe9") == "caf\xc3\xa9");
+
+	// More character sets than are kept open at once, in changing order
+	for (int round = 0; round < 3; round++) {
+		for (int i = 1; i <= 16; i++) {
+			auto charset = "iso-8859-" + to_string(round == 1 ? 17 - i : i);
+			if (charset == "iso-8859-12")
+				continue;
+			assert(charset_decode(charset, "abc") == "abc");
+		}
+	}
+
+	assert(charset_decode("iso-8859-1", "caf\xe9") == "caf\xc3\xa9");
+	assert(charset_decode("iso-8859-1", string(5000, '\xe9')).size() == 10000);
+
+	// Decoding bodies
+	Mimesis::Part part;
+	part["Content-Type"] = "text/plain; charset=iso-8859-1";
+	part["Content-Transfer-Encoding"] = "quoted-printable";
+	part.set_body("caf=E9=\r\n au lait\r\n");
+	assert(part.get_body() == "caf\xc3\xa9 au lait\r\n");
+
+	part["Content-Transfer-Encoding"] = "base64";
+	part.set_body(base64_encode("caf\xe9"));
+	assert(part.get_body() == "caf\xc3\xa9");
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+/* Deterministic generator of synthetic messages, used by the benchmarks.
+ * The same options and seed always result in the same corpus.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base64.hpp"
+
+namespace Corpus {
+
+struct Options {
+	size_t messages = 100;       // number of messages in the corpus
+	size_t body_size = 16384;    // size of each leaf body, before encoding
+	unsigned int depth = 2;      // nesting depth of multiparts, 0 for single part messages
+	unsigned int parts = 3;      // number of parts in each multipart
+	unsigned int headers = 20;   // number of extra headers in each message
+	std::vector<std::string> encodings = {"8bit", "quoted-printable", "base64"};
+	std::string charset = "iso-8859-1";
+	uint64_t seed = 1;
+};
+
+class Generator {
+	const Options &options;
+	uint64_t state;
+	size_t leaves = 0;
+
+	uint64_t next() {
+		// splitmix64
+		uint64_t z = (state += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	size_t uniform(size_t n) {
+		return next() % n;
+	}
+
+	std::string word() {
+		static const char letters[] = "etaoinshrdlucmfwypvbgkjqxz\xe9\xe8\xfc\xf6";
+		std::string result;
+		size_t len = 1 + uniform(10);
+		for (size_t i = 0; i < len; i++)
+			result.push_back(letters[uniform(i ? sizeof letters - 1 : 26)]);
+		return result;
+	}
+
+	std::string text(size_t size) {
+		std::string result;
+		size_t line = 0;
+
+		while (result.size() < size) {
+			auto w = word();
+			if (line + w.size() + 1 > 72) {
+				result.append("\r\n");
+				line = 0;
+			} else if (line) {
+				result.push_back(' ');
+				line++;
+			}
+			result.append(w);
+			line += w.size();
+		}
+
+		result.append("\r\n");
+		return result;
+	}
+
+	std::string binary(size_t size) {
+		std::string result;
+		result.reserve(size);
+		for (size_t i = 0; i < size; i++)
+			result.push_back(static_cast<char>(next()));
+		return result;
+	}
+
+	void leaf(std::string &out) {
+		auto &encoding = options.encodings[leaves++ % options.encodings.size()];
+
+		if (encoding == "base64" && leaves % 2) {
+			auto filename = word() + ".bin";
+			out.append("Content-Type: application/octet-stream; name=\"" + filename + "\"\r\n");
+			out.append("Content-Disposition: attachment; filename=\"" + filename + "\"\r\n");
+			out.append("Content-Transfer-Encoding: base64\r\n\r\n");
+			out.append(base64_lines(binary(options.body_size)));
+			return;
+		}
+
+		auto subtype = uniform(2) ? "plain" : "html";
+		out.append(std::string("Content-Type: text/") + subtype + "; charset=" + options.charset + "\r\n");
+		out.append("Content-Transfer-Encoding: " + encoding + "\r\n\r\n");
+
+		auto body = text(options.body_size);
+		if (encoding == "base64")
+			out.append(base64_lines(body));
+		else if (encoding == "quoted-printable")
+			out.append(quoted_printable(body));
+		else
+			out.append(body);
+	}
+
+	void part(std::string &out, unsigned int depth) {
+		if (!depth) {
+			leaf(out);
+			return;
+		}
+
+		auto boundary = "=_" + base64_encode(binary(12)) + std::to_string(depth);
+		out.append("Content-Type: multipart/" + std::string(depth == options.depth ? "mixed" : "alternative") + "; boundary=\"" + boundary + "\"\r\n\r\n");
+		out.append("This is a multi-part message in MIME format.\r\n");
+
+		for (unsigned int i = 0; i < options.parts; i++) {
+			out.append("--" + boundary + "\r\n");
+			part(out, depth - 1);
+		}
+
+		out.append("--" + boundary + "--\r\n");
+	}
+
+	public:
+	static std::string base64_lines(const std::string &data) {
+		auto encoded = base64_encode(data);
+		std::string result;
+		for (size_t i = 0; i < encoded.size(); i += 76) {
+			result.append(encoded, i, 76);
+			result.append("\r\n");
+		}
+		return result;
+	}
+
+	static std::string quoted_printable(const std::string &data) {
+		static const char hex[] = "0123456789ABCDEF";
+		std::string result;
+		size_t line = 0;
+
+		for (size_t i = 0; i < data.size(); i++) {
+			uint8_t c = data[i];
+
+			if (c == '\r' && i + 1 < data.size() && data[i + 1] == '\n') {
+				result.append("\r\n");
+				line = 0;
+				i++;
+				continue;
+			}
+
+			size_t len = (c == '=' || c < 32 || c > 126) ? 3 : 1;
+			if (line + len > 75) {
+				result.append("=\r\n");
+				line = 0;
+			}
+
+			if (len == 3) {
+				result.push_back('=');
+				result.push_back(hex[c >> 4]);
+				result.push_back(hex[c & 15]);
+			} else {
+				result.push_back(c);
+			}
+
+			line += len;
+		}
+
+		return result;
+	}
+
+	explicit Generator(const Options &options): options(options), state(options.seed) {}
+
+	std::string message() {
+		std::string out;
+		out.append("From: " + word() + " <" + word() + "@example.org>\r\n");
+		out.append("To: " + word() + " <" + word() + "@example.org>\r\n");
+		out.append("Subject: " + word() + " " + word() + " " + word() + "\r\n");
+		out.append("Date: Thu, 01 Jan 1970 00:00:00 +0000\r\n");
+		out.append("Message-ID: <" + std::to_string(next()) + "@example.org>\r\n");
+
+		for (unsigned int i = 0; i < options.headers; i++)
+			out.append("X-Header-" + std::to_string(i) + ": " + word() + " " + word() + "\r\n");
+
+		out.append("MIME-Version: 1.0\r\n");
+		part(out, options.depth);
+		return out;
+	}
+
+	std::vector<std::string> corpus() {
+		std::vector<std::string> result;
+		for (size_t i = 0; i < options.messages; i++)
+			result.push_back(message());
+		return result;
+	}
+};
+
+}
@@ -0,0 +1,123 @@
+/* This tests formatting and parsing the Date header. */
+
+#include <cassert>
+#include <chrono>
+#include <clocale>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+using namespace std::chrono;
+
+static system_clock::time_point at(long long seconds) {
+	return system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+static bool parses_as(const string &date, long long seconds) {
+	Mimesis::Message msg;
+	msg["Date"] = date;
+	return msg.get_date() == at(seconds);
+}
+
+static string strftime_date(time_t t) {
+	struct tm tm{};
+	localtime_r(&t, &tm);
+	char str[128];
+	strftime(str, sizeof str, "%a, %d %b %Y %T %z", &tm);
+	return str;
+}
+
+int main() {
+	Mimesis::Message msg;
+
+	// Formatting in UTC
+	setenv("TZ", "UTC", 1);
+	tzset();
+	msg.set_date(at(0));
+	assert(msg["Date"] == "Thu, 01 Jan 1970 00:00:00 +0000");
+	msg.set_date(at(951782400));
+	assert(msg["Date"] == "Tue, 29 Feb 2000 00:00:00 +0000");
+
+	// Formatting with other time zones
+	setenv("TZ", "CET-1", 1);
+	tzset();
+	msg.set_date(at(1));
+	assert(msg["Date"] == "Thu, 01 Jan 1970 01:00:01 +0100");
+	setenv("TZ", "NST+3:30", 1);
+	tzset();
+	msg.set_date(at(2));
+	assert(msg["Date"] == "Wed, 31 Dec 1969 20:30:02 -0330");
+
+	// The same time is formatted again when the time zone changes.
+	setenv("TZ", "CET-1", 1);
+	tzset();
+	msg.set_date(at(2));
+	assert(msg["Date"] == "Thu, 01 Jan 1970 01:00:02 +0100");
+	setenv("TZ", "NST+3:30", 1);
+	tzset();
+	msg.set_date(at(2));
+	assert(msg["Date"] == "Wed, 31 Dec 1969 20:30:02 -0330");
+
+	// Formatting does not depend on the locale
+	setlocale(LC_ALL, "");
+	for (long long t = -86400LL * 366; t < 4102444800LL; t += 86400LL * 13 + 3607) {
+		msg.set_date(at(t));
+		assert(msg["Date"] == strftime_date(t));
+	}
+	setlocale(LC_ALL, "C");
+	for (long long t = 4102444800LL; t > 0; t -= 86400LL * 29 + 61) {
+		msg.set_date(at(t));
+		assert(msg["Date"] == strftime_date(t));
+		assert(msg.get_date() == at(t));
+	}
+
+	// Received headers use the same format
+	msg.add_received("from localhost", at(3));
+	assert(msg["Received"] == "from localhost; Wed, 31 Dec 1969 20:30:03 -0330");
+
+	// Parsing
+	assert(parses_as("Thu, 01 Jan 1970 00:00:00 +0000", 0));
+	assert(parses_as("Thu, 1 Jan 1970 01:00:00 +0100", 0));
+	assert(parses_as("1 Jan 1970 00:00 -0000", 0));
+	assert(parses_as("Fri, 21 Nov 1997 09:55:06 -0600", 880127706));
+	assert(parses_as("Tue, 1 Jul 2003 10:52:37 +0200", 1057049557));
+	assert(parses_as("Thu,\r\n 13\r\n  Feb\r\n    1969\r\n  23:32\r\n  -0330 (Newfoundland Time)", -27723480));
+
+	// Obsolete syntax
+	assert(parses_as("Thu, 1 Jan 70 00:00:00 GMT", 0));
+	assert(parses_as("Wed, 31 Dec 1969 19:00:00 EST", 0));
+	assert(parses_as("Wed, 31 Dec 1969 20:00:00 EDT", 0));
+	assert(parses_as("Wed, 31 Dec 1969 16:00:00 PST", 0));
+	assert(parses_as("Thu, 01 Jan 1970 00:00:00 UT", 0));
+	assert(parses_as("Thu, 01 Jan 1970 00:00:00 A", 0));
+	assert(parses_as("Thu , 01 Jan 1970 00 : 00 : 00 (comment) +0000 (UTC)", 0));
+	assert(parses_as("(comment) Thursday, 01 January 1970 00:00:00 +0000", 0));
+	assert(parses_as("21 Nov 97 09:55:06 GMT", 880106106));
+	assert(parses_as("01 Jan 2049 00:00:00 +0000", 2493072000LL));
+	assert(parses_as("01 Jan 49 00:00:00 +0000", 2493072000LL));
+	assert(parses_as("01 Jan 149 00:00:00 +0000", 2493072000LL));
+
+	// Invalid dates
+	assert(parses_as("", 0));
+	assert(parses_as("garbage", 0));
+	assert(parses_as("Thu 01 Jan 1970 00:00:01 +0000", 0));
+	assert(parses_as("32 Jan 1970 00:00:01 +0000", 0));
+	assert(parses_as("01 Foo 1970 00:00:01 +0000", 0));
+	assert(parses_as("01 Jan 1970 24:00:01 +0000", 0));
+	assert(parses_as("01 Jan 1970 00:00:01 +01", 0));
+	assert(parses_as("31 Feb 2024 00:00:01 +0000", 0));
+	assert(parses_as("29 Feb 2023 00:00:01 +0000", 0));
+	assert(parses_as("29 Feb 1900 00:00:01 +0000", 0));
+	assert(parses_as("31 Apr 2024 00:00:01 +0000", 0));
+	assert(parses_as("01 Jan 1970 00:00:01 +0199", 0));
+	assert(parses_as("01 Jan 1970 00:00:01 + 0100", 0));
+	assert(parses_as("01 Jan 1970 00:00:01 -(comment)0100", 0));
+
+	// The last day of February in leap years
+	assert(parses_as("29 Feb 2024 00:00:00 +0000", 1709164800LL));
+	assert(parses_as("29 Feb 2000 00:00:00 +0000", 951782400LL));
+}
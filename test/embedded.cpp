@@ -0,0 +1,136 @@
+/* This tests accessing and modifying messages embedded in message/rfc822 parts. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	// The inner message uses different line endings, so reserializing it would show.
+	const string inner = "Subject: inner\nFrom: someone@example.org\n\nhello\n";
+	const string data =
+		"Subject: outer\r\n"
+		"Content-Type: multipart/mixed; boundary=\"b\"\r\n"
+		"\r\n"
+		"--b\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"first\r\n"
+		"--b\r\n"
+		"Content-Type: message/rfc822\r\n"
+		"\r\n"
+		+ inner +
+		"--b--\r\n";
+
+	Mimesis::Message msg;
+	msg.from_string(data);
+	const auto &cmsg = msg;
+
+	// Parsed on first use, then cached
+	assert(!cmsg.get_parts()[0].get_message());
+	auto embedded = cmsg.get_parts()[1].get_message();
+	assert(embedded);
+	assert(embedded == cmsg.get_parts()[1].get_message());
+	assert(embedded->get_header("Subject") == "inner");
+	assert(embedded->get_body() == "hello\n");
+
+	// Reading does not change how the message is saved, not even through a
+	// non-const part.
+	assert(msg.to_string() == data);
+	assert(msg.get_parts()[1].get_message()->get_header("Subject") == "inner");
+	assert(msg.to_string() == data);
+	assert(msg.get_section("2.1") == "hello\n");
+
+	// Modifying a copy leaves the original alone.
+	Mimesis::Message copy = msg;
+	copy.get_parts()[1].modify_message()->set_header("Subject", "changed");
+	assert(cmsg.get_parts()[1].get_message()->get_header("Subject") == "inner");
+	assert(msg.to_string() == data);
+	assert(copy != msg);
+
+	auto modified = inner;
+	modified.replace(9, 5, "changed");
+	assert(copy.get_parts()[1].get_body() == modified);
+	assert(copy.get_section("2") == modified);
+	assert(copy.get_section("2.HEADER.FIELDS (Subject)") == "Subject: changed\n\n");
+	assert(copy.to_string().find(modified) != string::npos);
+	assert(copy.to_string().size() == data.size() + 2);
+	assert(copy.serialized_size() == data.size() + 2);
+
+	Mimesis::Message reloaded;
+	reloaded.from_string(copy.to_string());
+	assert(reloaded == copy);
+	assert(reloaded.get_parts()[1].get_message()->get_header("Subject") == "changed");
+
+	// Replacing the body discards the modified message.
+	copy.get_parts()[1].set_body(inner);
+	assert(copy.to_string() == data);
+	assert(copy.get_parts()[1].get_message()->get_header("Subject") == "inner");
+
+	// A read through a non-const single part message keeps it byte-identical.
+	{
+		const string single_data = "Subject: outer\r\nContent-Type: message/rfc822\r\n\r\nSubject: inner\r\nCc:\r\n\r\ntext\r\n";
+		Mimesis::Message single;
+		single.from_string(single_data);
+		assert(single.get_message()->get_header("Subject") == "inner");
+		assert(single.to_string() == single_data);
+	}
+
+	// Embedded messages count towards the depth limit of the outer message.
+	{
+		string nested = "Subject: innermost\n\ntext\n";
+		for (int i = 0; i < 4000; i++)
+			nested = "Content-Type: message/rfc822\n\n" + nested;
+
+		Mimesis::ParseOptions options;
+		options.limits.max_depth = 5;
+		Mimesis::Message deep;
+		assert(deep.try_from_string(nested, options));
+
+		size_t levels = 0;
+		for (const Mimesis::Part *part = &deep; (part = part->get_message());)
+			levels++;
+		assert(levels == 5);
+
+		deep.clear();
+		deep.from_string(nested);
+		levels = 0;
+		for (const Mimesis::Part *part = &deep; (part = part->get_message());)
+			levels++;
+		assert(levels == Mimesis::ParseLimits().max_depth);
+	}
+
+	// Attached messages are kept as they are until saved.
+	{
+		Mimesis::Message forwarded;
+		forwarded.set_header("Subject", "forwarded");
+		forwarded.set_plain("text\r\n");
+
+		Mimesis::Message outer;
+		outer.set_header("Subject", "outer");
+		outer.set_plain("see attachment\r\n");
+		auto &part = outer.attach(forwarded);
+		assert(part.get_message());
+		assert(*part.get_message() == forwarded);
+		assert(part.get_body() == forwarded.to_string());
+
+		Mimesis::Message parsed;
+		parsed.from_string(outer.to_string());
+		assert(parsed.get_parts()[1].get_body() == forwarded.to_string());
+		assert(*parsed.get_parts()[1].get_message() == forwarded);
+	}
+
+	// Turning a single part into a multipart keeps the modified message.
+	{
+		Mimesis::Message single;
+		single.from_string("Subject: single\r\nContent-Type: message/rfc822\r\n\r\n" + inner);
+		single.modify_message()->set_header("Subject", "changed");
+		single.make_multipart("mixed");
+		assert(single.get_parts().size() == 1);
+		assert(single.get_parts()[0].get_body() == modified);
+		assert(single.flatten());
+		assert(single.get_body() == modified);
+	}
+}
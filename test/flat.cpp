@@ -0,0 +1,88 @@
+/* This tests the compact representation of messages,
+ * by comparing it with the regular representation.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static void compare(const Mimesis::FlatPart &flat, const Mimesis::Part &part) {
+	assert(flat.get_headers() == part.get_headers());
+	assert(flat.is_multipart() == part.is_multipart());
+	assert(flat.get_mime_type() == part.get_mime_type());
+	assert(flat.get_header("content-type") == part.get_header("Content-Type"));
+	assert(flat.get_header_parameter("Content-Type", "charset") == part.get_header_parameter("Content-Type", "charset"));
+	assert(flat.is_attachment() == part.is_attachment());
+	assert(flat.get_body() == part.get_body());
+	assert(flat.get_preamble() == part.get_preamble());
+	assert(flat.get_epilogue() == part.get_epilogue());
+	assert(flat.get_boundary() == part.get_boundary());
+	assert(flat.to_part() == part);
+
+	auto children = flat.get_parts();
+	assert(children.size() == part.get_parts().size());
+	for (size_t i = 0; i < children.size(); i++) {
+		assert(children[i].get_parent().get_index() == flat.get_index());
+		compare(children[i], part.get_parts()[i]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		Mimesis::Message msg;
+		msg.load(argv[i]);
+
+		Mimesis::FlatMessage flat;
+		flat.load(argv[i]);
+
+		assert(!flat.empty());
+		assert(!flat.get_root().get_parent());
+		assert(flat.to_string() == msg.to_string());
+		assert(flat.to_message() == msg);
+		compare(flat.get_root(), msg);
+
+		// Loading again replaces the previous contents
+		assert(flat.try_from_string(msg.to_string()));
+		assert(flat.to_string() == msg.to_string());
+	}
+
+	// Many distinct and repeated field names
+	{
+		string data;
+		for (int i = 0; i < 2000; i++)
+			data += "X-Field-" + to_string(i % 1000) + ": " + to_string(i) + "\r\n";
+		data += "\r\nbody\r\n";
+
+		Mimesis::Message msg;
+		msg.from_string(data);
+		Mimesis::FlatMessage flat;
+		flat.from_string(data);
+		assert(flat.to_string() == data);
+		compare(flat.get_root(), msg);
+	}
+
+	// Errors are reported like for a Part
+	{
+		Mimesis::FlatMessage flat;
+		auto result = flat.try_from_string("Content-Type: multipart/mixed\r\n\r\nbody\r\n");
+		assert(result.error == Mimesis::ParseError::missing_boundary);
+
+		bool thrown = false;
+		try {
+			flat.from_string("Content-Type: multipart/mixed; boundary=b\r\n\r\n--b\r\n\r\nbody\r\n");
+		} catch (runtime_error &) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		flat.clear();
+		assert(flat.empty());
+		assert(!flat.get_root());
+		assert(flat.to_string().empty());
+	}
+}
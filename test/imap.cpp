@@ -0,0 +1,128 @@
+/* This tests computing IMAP BODYSTRUCTURE and ENVELOPE responses. */
+
+#include <cassert>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	// A single part without a type
+	{
+		Mimesis::Message msg;
+		msg.from_string("Subject: test\r\n\r\nline 1\r\nline 2\r\n");
+		assert(msg.get_bodystructure(false) == "(\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 16 2)");
+		assert(msg.get_bodystructure() == "(\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 16 2 NIL NIL NIL NIL)");
+	}
+
+	// A multipart message with an attachment
+	{
+		Mimesis::Message msg;
+		msg.from_string(
+			"From: \"Doe, John\" <john@example.org>\r\n"
+			"To: jane@example.org (Jane), Group: a@example.org, <b@example.org>;\r\n"
+			"Subject: Hello\r\n"
+			"Date: Mon, 7 Feb 1994 21:52:25 -0800\r\n"
+			"Message-ID: <1@example.org>\r\n"
+			"Content-Type: multipart/mixed; boundary=\"b\"\r\n"
+			"\r\n"
+			"--b\r\n"
+			"Content-Type: text/plain; charset=\"utf-8\"; format=flowed\r\n"
+			"Content-Transfer-Encoding: quoted-printable\r\n"
+			"\r\n"
+			"caf=C3=A9\r\n"
+			"--b\r\n"
+			"Content-Type: application/pdf; name=\"a \\\"b\\\".pdf\"\r\n"
+			"Content-Disposition: attachment; filename=\"a.pdf\"\r\n"
+			"Content-Transfer-Encoding: base64\r\n"
+			"Content-ID: <pdf@example.org>\r\n"
+			"\r\n"
+			"SGVsbG8=\r\n"
+			"--b--\r\n");
+
+		assert(msg.get_bodystructure(false) ==
+			"((\"text\" \"plain\" (\"charset\" \"utf-8\" \"format\" \"flowed\") NIL NIL \"quoted-printable\" 11 1)"
+			"(\"application\" \"pdf\" (\"name\" \"a \\\"b\\\".pdf\") \"<pdf@example.org>\" NIL \"base64\" 10) \"mixed\")");
+		assert(msg.get_bodystructure() ==
+			"((\"text\" \"plain\" (\"charset\" \"utf-8\" \"format\" \"flowed\") NIL NIL \"quoted-printable\" 11 1 NIL NIL NIL NIL)"
+			"(\"application\" \"pdf\" (\"name\" \"a \\\"b\\\".pdf\") \"<pdf@example.org>\" NIL \"base64\" 10 NIL (\"attachment\" (\"filename\" \"a.pdf\")) NIL NIL)"
+			" \"mixed\" (\"boundary\" \"b\") NIL NIL NIL)");
+
+		assert(msg.get_envelope() ==
+			"(\"Mon, 7 Feb 1994 21:52:25 -0800\" \"Hello\""
+			" ((\"Doe, John\" NIL \"john\" \"example.org\"))"
+			" ((\"Doe, John\" NIL \"john\" \"example.org\"))"
+			" ((\"Doe, John\" NIL \"john\" \"example.org\"))"
+			" ((NIL NIL \"jane\" \"example.org\")(NIL NIL \"Group\" NIL)(NIL NIL \"a\" \"example.org\")(NIL NIL \"b\" \"example.org\")(NIL NIL NIL NIL))"
+			" NIL NIL NIL \"<1@example.org>\")");
+	}
+
+	// A forwarded message
+	{
+		Mimesis::Message inner;
+		inner.set_header("From", "inner@example.org");
+		inner.set_header("Subject", "Inner");
+		inner.set_body("inner body\r\n");
+
+		Mimesis::Message msg;
+		msg.set_header("Subject", "Fwd: Inner");
+		msg.attach(inner);
+
+		auto raw = inner.to_string();
+		assert(msg.get_bodystructure(false) ==
+			"(\"message\" \"rfc822\" NIL NIL NIL \"7bit\" " + to_string(raw.size()) +
+			" (NIL \"Inner\" ((NIL NIL \"inner\" \"example.org\")) ((NIL NIL \"inner\" \"example.org\")) ((NIL NIL \"inner\" \"example.org\")) NIL NIL NIL NIL NIL)"
+			" (\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 12 1) 4)");
+	}
+
+	// Text stored in a file and encoded while saving
+	for (size_t size: {57, 58, 200}) {
+		{
+			ofstream out("imap.tmp", ios::binary);
+			out << string(size, 'x');
+		}
+		Mimesis::Message msg;
+		msg.attach_file("imap.tmp", "text/plain", "x.txt");
+		unlink("imap.tmp");
+
+		auto saved = msg.get_section("1");
+		size_t lines = 0;
+		for (auto c: saved)
+			lines += c == '\n';
+		auto structure = msg.get_bodystructure(false);
+		assert(structure.find(" " + to_string(saved.size()) + " " + to_string(lines) + ")") != string::npos);
+	}
+
+	// Messages nested too deeply are described as opaque data
+	{
+		const string innermost = "Subject: x\r\n\r\nhi\r\n";
+		const string inner = "Content-Type: message/rfc822\r\n\r\n" + innermost;
+		Mimesis::ParseOptions options;
+		options.limits.max_depth = 1;
+		Mimesis::Message msg;
+		assert(msg.try_from_string("Content-Type: message/rfc822\r\n\r\n" + inner, options));
+		assert(msg.get_bodystructure(false) ==
+			"(\"message\" \"rfc822\" NIL NIL NIL \"7bit\" " + to_string(inner.size()) +
+			" (NIL NIL NIL NIL NIL NIL NIL NIL NIL NIL)"
+			" (\"application\" \"octet-stream\" NIL NIL NIL \"7bit\" " + to_string(innermost.size()) + ") 5)");
+
+		string nested = innermost;
+		for (int i = 0; i < 150; i++)
+			nested = "Content-Type: message/rfc822\r\n\r\n" + nested;
+		msg.clear();
+		msg.from_string(nested);
+		assert(msg.get_bodystructure().find("\"application\" \"octet-stream\"") != string::npos);
+	}
+
+	// Non-ASCII strings are sent as literals
+	{
+		Mimesis::Message msg;
+		msg.set_header("Subject", "caf\xc3\xa9");
+		msg.set_body("body\r\n");
+		assert(msg.get_envelope() == "(NIL {5}\r\ncaf\xc3\xa9 NIL NIL NIL NIL NIL NIL NIL NIL)");
+	}
+}
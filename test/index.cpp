@@ -0,0 +1,136 @@
+/* This tests indexing the parts of a stored message. */
+
+#include <cassert>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static size_t count_lines(const string &str) {
+	size_t lines = 0;
+	for (auto c: str)
+		lines += c == '\n';
+	return lines;
+}
+
+int main() {
+	Mimesis::Message orig;
+	orig.set_header("From", "me");
+	orig.set_header("Subject", "Index");
+	orig.set_plain("plain\r\ntext\r\n");
+	orig.set_html("<p>html</p>\r\n");
+	orig.attach("SGVsbG8=\r\n", "application/octet-stream", "hello.bin").set_header("Content-Transfer-Encoding", "base64");
+	orig.save("index.eml");
+	auto str = orig.to_string();
+
+	// Build the index while loading
+	Mimesis::MessageIndex index;
+	Mimesis::ParseOptions options;
+	options.index = &index;
+	Mimesis::Message msg;
+	assert(msg.try_load("index.eml", options));
+	assert(index.file_size == str.size());
+	assert(index.entries.size() == 5);
+
+	// Every part is indexed in the order the parts appear
+	size_t i = 0;
+	for (auto &position: msg.walk()) {
+		auto &part = position.get_part();
+		auto &entry = index.entries[i];
+		assert(index.get_section(i) == position.get_section());
+		assert(index.find(position.get_section()) == &entry);
+		assert(entry.content_type == part.get_mime_type());
+		assert(entry.transfer_encoding == part.get_header_value("Content-Transfer-Encoding"));
+		assert(entry.body_offset == entry.header_offset + entry.header_length);
+
+		auto header = str.substr(entry.header_offset, entry.header_length);
+		assert(header.find(part.get_headers()[0].first + ": ") == 0);
+		assert(header.substr(header.size() - 4) == "\r\n\r\n");
+
+		auto body = str.substr(entry.body_offset, entry.body_length);
+		assert(body == part.to_string().substr(header.size()));
+		assert(entry.body_lines == count_lines(body));
+		i++;
+	}
+
+	assert(index.entries[0].header_offset == 0);
+	assert(index.entries[0].body_offset + index.entries[0].body_length == str.size());
+	assert(index.find("1")->content_type == "multipart/alternative");
+	assert(index.find("1.2")->content_type == "text/html");
+	assert(!index.find("3"));
+	assert(!index.find("1.2.3"));
+	assert(!index.find("1."));
+	assert(!index.find("x"));
+	assert(index.find("2.1") == index.find("2"));
+
+	// Save and load the index, then map only one section
+	index.save("index.idx");
+	Mimesis::MessageIndex loaded;
+	assert(loaded.load("index.idx", "index.eml"));
+	assert(loaded.entries.size() == index.entries.size());
+	auto entry = loaded.find("1.1");
+	Mimesis::MappedRange range("index.eml", entry->body_offset, entry->body_length);
+	assert(range.to_string() == "plain\r\ntext\r\n");
+	Mimesis::MappedRange empty("index.eml", 0, 0);
+	assert(empty.size() == 0 && empty.to_string().empty());
+
+	// A corrupted index is rejected
+	{
+		ifstream in("index.idx", ios::binary);
+		string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		ofstream out("index.idx", ios::binary);
+		out << data.substr(0, data.size() - 1);
+	}
+	assert(!loaded.load("index.idx", "index.eml"));
+	assert(loaded.entries.size() == index.entries.size());
+	assert(!loaded.load("nonexistent.idx", "index.eml"));
+
+	// An index of a modified message is rejected
+	index.save("index.idx");
+	{
+		ofstream out("index.eml", ios::binary | ios::app);
+		out << "\r\n";
+	}
+	assert(!loaded.load("index.idx", "index.eml"));
+
+	// An index with only empty strings round-trips
+	{
+		ofstream out("index.eml", ios::binary);
+		out << "Subject: no type\r\n\r\n";
+	}
+	Mimesis::MessageIndex header_only;
+	options.index = &header_only;
+	msg.clear();
+	assert(msg.try_load("index.eml", options));
+	assert(header_only.entries.size() == 1);
+	assert(header_only.entries[0].content_type.empty());
+	header_only.save("index.idx");
+	assert(loaded.load("index.idx", "index.eml"));
+	assert(loaded.entries.size() == 1);
+
+	// Values that do not fit are truncated
+	{
+		ofstream out("index.eml", ios::binary);
+		out << "Content-Type: text/" << string(70000, 'x') << "\r\n\r\nbody\r\n";
+	}
+	msg.clear();
+	assert(msg.try_load("index.eml", options));
+	header_only.save("index.idx");
+	assert(loaded.load("index.idx", "index.eml"));
+	assert(loaded.entries[0].content_type.size() == 0xffff);
+
+	// Reusing the index for another message replaces its entries
+	options.index = &index;
+	msg.clear();
+	assert(msg.try_load("index.eml", options));
+	assert(index.entries.size() == 1);
+	index.save("index.idx");
+	assert(loaded.load("index.idx", "index.eml"));
+
+	unlink("index.eml");
+	unlink("index.idx");
+}
@@ -0,0 +1,141 @@
+/* This tests converting line endings between LF and CRLF. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+#include "line-ending.hpp"
+
+using namespace std;
+
+// Converts one byte at a time, to compare with the vectorized conversions.
+static string reference(const string &in, bool crlf) {
+	string out;
+	for (size_t i = 0; i < in.size(); i++) {
+		if (crlf && in[i] == '\n' && (!i || in[i - 1] != '\r'))
+			out.push_back('\r');
+		if (!crlf && in[i] == '\r' && i + 1 < in.size() && in[i + 1] == '\n')
+			continue;
+		out.push_back(in[i]);
+	}
+	return out;
+}
+
+int main() {
+	assert(lf_to_crlf("") == "");
+	assert(lf_to_crlf("a\nb\r\nc\rd\n") == "a\r\nb\r\nc\rd\r\n");
+	assert(crlf_to_lf("a\r\nb\nc\rd\r\n\r") == "a\nb\nc\rd\n\r");
+
+	// Line endings at and across the edges of 16 byte blocks
+	static const char alphabet[] = {'a', '\r', '\n'};
+	for (size_t len = 0; len < 50; len++) {
+		for (unsigned int seed = 0; seed < 8; seed++) {
+			string data;
+			for (size_t i = 0; i < len; i++)
+				data.push_back(alphabet[(i * 7 + seed * (i + 3)) % 3]);
+			assert(lf_to_crlf(data) == reference(data, true));
+			assert(crlf_to_lf(data) == reference(data, false));
+			assert(crlf_to_lf(lf_to_crlf(data)) == crlf_to_lf(data));
+		}
+	}
+
+	const string lf =
+		"Content-Type: multipart/mixed; boundary=foo\n"
+		"\n"
+		"preamble\n"
+		"--foo\n"
+		"Content-Type: text/plain\n"
+		"\n"
+		"one\n"
+		"two\n"
+		"--foo\n"
+		"Content-Type: application/octet-stream\n"
+		"Content-Transfer-Encoding: binary\n"
+		"\n"
+		"raw\ndata\r\n"
+		"--foo--\n"
+		"epilogue\n";
+	const string crlf =
+		"Content-Type: multipart/mixed; boundary=foo\r\n"
+		"\r\n"
+		"preamble\r\n"
+		"--foo\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"one\r\n"
+		"two\r\n"
+		"--foo\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Content-Transfer-Encoding: binary\r\n"
+		"\r\n"
+		"raw\ndata\r\n"
+		"--foo--\r\n"
+		"epilogue\r\n";
+
+	// Converting while loading, leaving the binary body alone
+	Mimesis::ParseOptions options;
+	options.line_ending = Mimesis::LineEnding::crlf;
+	Mimesis::Message msg;
+	assert(msg.try_from_string(lf, options));
+	assert(msg.get_parts().size() == 2);
+	assert(msg.get_parts()[0].get_body() == "one\r\ntwo\r\n");
+	assert(msg.to_string() == crlf);
+
+	options.line_ending = Mimesis::LineEnding::lf;
+	msg.clear();
+	assert(msg.try_from_string(crlf, options));
+	assert(msg.to_string() == lf);
+
+	// A last line without a newline gets one when saved, like other lines
+	msg.clear();
+	options.line_ending = Mimesis::LineEnding::crlf;
+	assert(msg.try_from_string("Subject: test\n\nbody", options));
+	assert(msg.get_header("Subject") == "test");
+	assert(msg.to_string() == "Subject: test\r\n\r\nbody\r\n");
+
+	// Converting a loaded message
+	msg.clear();
+	msg.from_string(lf);
+	msg.convert_line_endings(true);
+	assert(msg.to_string() == crlf);
+	msg.convert_line_endings(false);
+	assert(msg.to_string() == lf);
+
+	// Mixed line endings in the header and delimiters
+	msg.clear();
+	msg.from_string("A: 1\r\nB: 2\nC: 3\r\n\r\nbody\n");
+	msg.convert_line_endings(true);
+	assert(msg.to_string() == "A: 1\r\nB: 2\r\nC: 3\r\n\r\nbody\r\n");
+
+	msg.clear();
+	msg.from_string(
+		"Content-Type: multipart/mixed; boundary=b\r\n"
+		"\r\n"
+		"--b\n"
+		"\r\n"
+		"text\n"
+		"--b--\n");
+	msg.convert_line_endings(true);
+	assert(msg.to_string() ==
+		"Content-Type: multipart/mixed; boundary=b\r\n"
+		"\r\n"
+		"--b\r\n"
+		"\r\n"
+		"text\r\n"
+		"--b--\r\n");
+
+	// Including an embedded message
+	const string embedded =
+		"Content-Type: message/rfc822\n"
+		"\n"
+		"Subject: inner\n"
+		"\n"
+		"text\n";
+	msg.clear();
+	msg.from_string(embedded);
+	assert(msg.get_message());
+	msg.convert_line_endings(true);
+	assert(msg.to_string() == lf_to_crlf(embedded));
+	assert(msg.get_message()->get_body() == "text\r\n");
+}
@@ -8,6 +8,9 @@
 #include <fstream>
 #include <stdexcept>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <mimesis.hpp>
 
 using namespace std;
@@ -29,6 +32,27 @@ static bool load_save(const Mimesis::Message &msg) {
 		assert(msg2 == msg);
 	}
 
+	// Save to a file descriptor
+	{
+		int fd = open("load-save.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		assert(fd != -1);
+		msg.save(fd);
+		assert(close(fd) == 0);
+		Mimesis::Message msg2;
+		msg2.load("load-save.tmp");
+		assert(msg2 == msg);
+	}
+
+	// Save to a preallocated buffer
+	{
+		string str = msg.to_string();
+		assert(msg.serialized_size() == str.size());
+		string buffer(str.size() + 1, '!');
+		assert(msg.save_to_buffer(&buffer[0]) == str.size());
+		assert(buffer.compare(0, str.size(), str) == 0);
+		assert(buffer.back() == '!');
+	}
+
 	// Save to and load from stream using operators
 	{
 		stringstream ss;
@@ -42,7 +66,26 @@ static bool load_save(const Mimesis::Message &msg) {
 }
 
 
+// Messages with more pieces than fit in a single writev() call
+static bool save_many_headers() {
+	Mimesis::Message msg;
+	for (int i = 0; i < 1000; i++)
+		msg.append_header("X-Header-" + to_string(i), to_string(i));
+	msg.set_body("body\r\n");
+
+	msg.save("load-save.tmp");
+	ifstream in("load-save.tmp");
+	stringstream ss;
+	ss << in.rdbuf();
+	assert(ss.str() == msg.to_string());
+
+	return true;
+}
+
 int main(int argc, char *argv[]) {
+	if (!save_many_headers())
+		return 1;
+
 	if (argc <= 1) {
 		Mimesis::Message msg;
 		msg.load(cin);
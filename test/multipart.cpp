@@ -327,4 +327,25 @@ int main() {
 	assert(msg.get_parts()[0].is_singlepart("text/plain"));
 	assert(msg.get_parts()[1].is_singlepart("text/html"));
 
+	// Copies share bodies, but modifying one does not affect the other
+	{
+		msg.set_preamble("preamble\r\n");
+		msg.set_epilogue("epilogue\r\n");
+		Mimesis::Message copy = msg;
+		assert(copy == msg);
+
+		copy.get_parts()[0].set_body("changed\r\n");
+		copy.set_preamble("changed\r\n");
+		copy.set_epilogue("changed\r\n");
+		copy.set_header("To", "you");
+		assert(msg.get_parts()[0].get_body() == "plain body\r\n");
+		assert(msg.get_preamble() == "preamble\r\n");
+		assert(msg.get_epilogue() == "epilogue\r\n");
+		assert(msg.get_header("To").empty());
+
+		Mimesis::Part part;
+		part.append_part(msg.get_parts()[1]);
+		part.get_parts()[0].clear_body();
+		assert(msg.get_parts()[1].get_body() == "html body\r\n");
+	}
 }
@@ -0,0 +1,145 @@
+/* This tests parsing malformed messages,
+ * with and without recovering from errors.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static bool load_throws(const string &data) {
+	Mimesis::Message msg;
+	try {
+		msg.from_string(data);
+	} catch (runtime_error &e) {
+		return true;
+	}
+	return false;
+}
+
+int main() {
+	Mimesis::ParseOptions recover;
+	recover.recover = true;
+
+	// A valid message
+	{
+		const string data = "From: me\r\nSubject: test\r\n\r\nbody\r\n";
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(result);
+		assert(result.error == Mimesis::ParseError::none);
+		assert(result.recovered == 0);
+		assert(msg.to_string() == data);
+	}
+
+	// Invalid header lines
+	{
+		const string data = "From: me\r\nInvalid header\r\nSubject: test\r\n\r\nbody\r\n";
+		assert(load_throws(data));
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(!result);
+		assert(result.error == Mimesis::ParseError::invalid_header);
+		assert(result.offset == 10);
+		assert(string(result.reason) == "invalid header line");
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, recover);
+		assert(result);
+		assert(result.recovered == 1);
+		assert(msg2.get_header("From") == "me");
+		assert(msg2.get_header("Subject") == "test");
+		assert(msg2.get_body() == "body\r\n");
+	}
+
+	{
+		const string data = " continuation\r\n: empty field\r\nFrom: me\r\n\r\nbody\r\n";
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(result.error == Mimesis::ParseError::invalid_header);
+		assert(result.offset == 0);
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, recover);
+		assert(result);
+		assert(result.recovered == 2);
+		assert(msg2.get_headers().size() == 1);
+		assert(msg2.get_body() == "body\r\n");
+	}
+
+	// Multipart without a boundary
+	{
+		const string data = "Content-Type: multipart/mixed\r\n\r\n--foo\r\n\r\nbody\r\n--foo--\r\n";
+		assert(load_throws(data));
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(result.error == Mimesis::ParseError::missing_boundary);
+		assert(result.offset == 33);
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, recover);
+		assert(result);
+		assert(result.recovered == 1);
+		assert(msg2.is_singlepart());
+		assert(msg2.get_body() == "--foo\r\n\r\nbody\r\n--foo--\r\n");
+	}
+
+	// Unterminated multipart
+	{
+		const string data =
+			"Content-Type: multipart/mixed; boundary=outer\r\n"
+			"\r\n"
+			"--outer\r\n"
+			"Content-Type: multipart/alternative; boundary=inner\r\n"
+			"\r\n"
+			"--inner\r\n"
+			"\r\n"
+			"first\r\n"
+			"--inner\r\n"
+			"\r\n"
+			"second\r\n";
+		assert(load_throws(data));
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(result.error == Mimesis::ParseError::unterminated_multipart);
+		assert(result.offset == data.size());
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, recover);
+		assert(result);
+		assert(result.recovered == 2);
+		assert(msg2.get_parts().size() == 1);
+		assert(msg2.get_parts()[0].get_parts().size() == 2);
+		assert(msg2.get_parts()[0].get_parts()[1].get_body() == "second\r\n");
+	}
+
+	// Multipart without any boundary lines
+	{
+		const string data = "Content-Type: multipart/mixed; boundary=foo\r\n\r\npreamble\r\n";
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data);
+		assert(result.error == Mimesis::ParseError::unterminated_multipart);
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, recover);
+		assert(result);
+		assert(msg2.is_multipart());
+		assert(msg2.get_parts().empty());
+		assert(msg2.get_preamble() == "preamble\r\n");
+	}
+
+	// Missing files
+	{
+		Mimesis::Message msg;
+		auto result = msg.try_load("/nonexistent/message");
+		assert(result.error == Mimesis::ParseError::read_error);
+	}
+}
@@ -0,0 +1,155 @@
+/* This tests the resource limits of the parser. */
+
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string nested(size_t depth) {
+	string data;
+	for (size_t i = 0; i < depth; i++)
+		data += "Content-Type: multipart/mixed; boundary=b" + to_string(i) + "\r\n\r\n--b" + to_string(i) + "\r\n";
+	data += "\r\nbody\r\n";
+	for (size_t i = depth; i-- > 0;)
+		data += "--b" + to_string(i) + "--\r\n";
+	return data;
+}
+
+static string many_parts(size_t count) {
+	string data = "Content-Type: multipart/mixed; boundary=b\r\n\r\n";
+	for (size_t i = 0; i < count; i++)
+		data += "--b\r\n\r\npart " + to_string(i) + "\r\n";
+	data += "--b--\r\nepilogue\r\n";
+	return data;
+}
+
+static size_t depth(const Mimesis::Part &part) {
+	size_t result = 0;
+	for (auto &child: part.get_parts())
+		result = max(result, depth(child) + 1);
+	return result;
+}
+
+int main() {
+	// Nesting depth
+	{
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(nested(50));
+		assert(result);
+		assert(depth(msg) == 50);
+
+		// Deeply nested messages are rejected by default
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(nested(100000));
+		assert(result.error == Mimesis::ParseError::too_deep);
+
+		Mimesis::Message msg3;
+		bool thrown = false;
+		try {
+			msg3.from_string(nested(100000));
+		} catch (runtime_error &e) {
+			thrown = true;
+		}
+		assert(thrown);
+
+		Mimesis::ParseOptions options;
+		options.limits.max_depth = 3;
+		options.limits.truncate = true;
+		Mimesis::Message msg4;
+		result = msg4.try_from_string(nested(10), options);
+		assert(result);
+		assert(result.truncated);
+		assert(depth(msg4) == 3);
+	}
+
+	// Number of parts
+	{
+		Mimesis::ParseOptions options;
+		options.limits.max_parts = 5;
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(many_parts(4), options);
+		assert(result);
+		assert(!result.truncated);
+		assert(msg.get_parts().size() == 4);
+
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(many_parts(10), options);
+		assert(result.error == Mimesis::ParseError::too_many_parts);
+
+		options.limits.truncate = true;
+		Mimesis::Message msg3;
+		result = msg3.try_from_string(many_parts(10), options);
+		assert(result);
+		assert(result.truncated);
+		assert(msg3.get_parts().size() == 4);
+		assert(msg3.get_parts()[3].get_body() == "part 3\r\n");
+		assert(msg3.get_epilogue() == "epilogue\r\n");
+	}
+
+	// Header size
+	{
+		string data = "From: me\r\nSubject: test\r\n";
+		for (int i = 0; i < 100; i++)
+			data += "X-Header: " + to_string(i) + "\r\n";
+		data += "To: you\r\n\r\nbody\r\n";
+
+		Mimesis::ParseOptions options;
+		options.limits.max_header_bytes = 100;
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data, options);
+		assert(result.error == Mimesis::ParseError::header_too_large);
+
+		options.limits.truncate = true;
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, options);
+		assert(result);
+		assert(result.truncated);
+		assert(msg2.get_header("Subject") == "test");
+		assert(msg2.get_header("To").empty());
+		assert(msg2.get_body() == "body\r\n");
+	}
+
+	// Body size
+	{
+		string data = "From: me\r\n\r\n" + string(1000, 'x') + "\r\n";
+
+		Mimesis::ParseOptions options;
+		options.limits.max_body_size = 100;
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(data, options);
+		assert(result.error == Mimesis::ParseError::body_too_large);
+
+		options.limits.truncate = true;
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(data, options);
+		assert(result);
+		assert(result.truncated);
+		assert(msg2.get_body() == string(100, 'x'));
+	}
+
+	// Total size
+	{
+		Mimesis::ParseOptions options;
+		options.limits.max_total_size = 40;
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(many_parts(10), options);
+		assert(result.error == Mimesis::ParseError::message_too_large);
+
+		options.limits.truncate = true;
+		Mimesis::Message msg2;
+		result = msg2.try_from_string(many_parts(10), options);
+		assert(result);
+		assert(result.truncated);
+		assert(msg2.get_parts().size() == 10);
+		assert(msg2.get_parts()[4].get_body() == "part 4\r\n");
+		assert(msg2.get_parts()[5].get_body() == "");
+	}
+}
@@ -0,0 +1,172 @@
+/* This tests rewriting messages while they are being parsed. */
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string rewrite(const Mimesis::Rewriter &rewriter, const string &message) {
+	istringstream in(message);
+	ostringstream out;
+	assert(rewriter.rewrite(in, out));
+	return out.str();
+}
+
+static const string header =
+	"Subject: hello\r\n"
+	"To: someone@example.org,\r\n"
+	"  someone.else@example.org\r\n"
+	"Content-Type: multipart/mixed; boundary=\"b\"\r\n"
+	"\r\n";
+
+static const string text =
+	"--b \r\n"
+	"Content-Type: text/plain\r\n"
+	"\r\n"
+	"some text\r\n"
+	"more text\r\n";
+
+static const string attachment =
+	"--b\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Content-Disposition: attachment; filename=\"data.bin\"\r\n"
+	"Content-Transfer-Encoding: base64\r\n"
+	"\r\n"
+	"AAECAwQFBgcICQ==\r\n";
+
+static const string closing = "--b--\r\nepilogue\r\n";
+
+static const string message = header + text + attachment + closing;
+
+int main() {
+	// Without hooks, the message is copied as it is.
+	{
+		Mimesis::Rewriter rewriter;
+		assert(rewrite(rewriter, message) == message);
+	}
+
+	// Changing the header of the message gives the same result as loading,
+	// changing and saving it.
+	{
+		Mimesis::Rewriter rewriter;
+		rewriter.header_hook = [](Mimesis::Part &part, size_t depth) {
+			if (!depth) {
+				part.set_header("Subject", "[list] " + part.get_header("Subject"));
+				part.prepend_header("Received", "by example.org");
+			}
+			return Mimesis::RewriteAction::keep;
+		};
+
+		Mimesis::Message msg;
+		msg.from_string(message);
+		msg.set_header("Subject", "[list] hello");
+		msg.prepend_header("Received", "by example.org");
+
+		assert(rewrite(rewriter, message) == msg.to_string());
+	}
+
+	// Removing attachments removes their delimiter lines as well.
+	{
+		Mimesis::Rewriter rewriter;
+		rewriter.header_hook = [](Mimesis::Part &part, size_t) {
+			return part.is_attachment() ? Mimesis::RewriteAction::remove : Mimesis::RewriteAction::keep;
+		};
+		assert(rewrite(rewriter, header + text + attachment + closing) == header + text + closing);
+		assert(rewrite(rewriter, header + attachment + text + closing) == header + text + closing);
+	}
+
+	// Replacing a body
+	{
+		Mimesis::Rewriter rewriter;
+		rewriter.header_hook = [](Mimesis::Part &part, size_t) {
+			if (!part.is_attachment())
+				return Mimesis::RewriteAction::keep;
+			part.set_header("Content-Disposition", "attachment; filename=\"removed.txt\"");
+			part.set_header("Content-Type", "text/plain");
+			part.erase_header("Content-Transfer-Encoding");
+			part.set_body("The attachment was removed.\r\n");
+			return Mimesis::RewriteAction::replace;
+		};
+		assert(rewrite(rewriter, header + text + attachment + closing) == header + text +
+			"--b\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Disposition: attachment; filename=\"removed.txt\"\r\n"
+			"\r\n"
+			"The attachment was removed.\r\n" + closing);
+	}
+
+	// Filtering a body in chunks
+	{
+		Mimesis::Rewriter rewriter;
+		size_t chunks = 0;
+		size_t last = 0;
+		rewriter.chunk_size = 4;
+		rewriter.header_hook = [](Mimesis::Part &part, size_t) {
+			return part.is_mime_type("text/plain") ? Mimesis::RewriteAction::filter : Mimesis::RewriteAction::keep;
+		};
+		rewriter.body_hook = [&](const Mimesis::Part &part, string &chunk, bool is_last) {
+			assert(part.is_mime_type("text/plain"));
+			for (auto &c: chunk)
+				c = toupper(c);
+			chunks++;
+			last += is_last;
+		};
+
+		auto upper = text;
+		upper.replace(upper.find("some"), 20, "SOME TEXT\r\nMORE TEXT");
+		assert(rewrite(rewriter, header + text + closing) == header + upper + closing);
+		assert(chunks == 3);
+		assert(last == 1);
+	}
+
+	// Parse errors are returned, after writing what has been read.
+	{
+		Mimesis::Rewriter rewriter;
+		istringstream in(header + text);
+		ostringstream out;
+		auto result = rewriter.rewrite(in, out);
+		assert(!result);
+		assert(result.error == Mimesis::ParseError::unterminated_multipart);
+		assert(out.str() == header + text);
+
+		rewriter.options.recover = true;
+		assert(rewrite(rewriter, header + text) == header + text);
+	}
+
+	// From one file descriptor to another
+	{
+		{
+			ofstream out("rewrite.in", ios::binary);
+			out << message;
+		}
+
+		Mimesis::Rewriter rewriter;
+		rewriter.header_hook = [](Mimesis::Part &part, size_t) {
+			return part.is_attachment() ? Mimesis::RewriteAction::remove : Mimesis::RewriteAction::keep;
+		};
+
+		int in = open("rewrite.in", O_RDONLY);
+		int out = open("rewrite.out", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		assert(in != -1 && out != -1);
+		assert(rewriter.rewrite(in, out));
+		close(in);
+		close(out);
+
+		ifstream result("rewrite.out", ios::binary);
+		stringstream ss;
+		ss << result.rdbuf();
+		assert(ss.str() == header + text + closing);
+
+		unlink("rewrite.in");
+		unlink("rewrite.out");
+	}
+}
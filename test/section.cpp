@@ -0,0 +1,146 @@
+/* This tests extracting IMAP sections and partial ranges from a message. */
+
+#include <cassert>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static bool is_invalid(const Mimesis::Part &part, const string &section) {
+	try {
+		part.get_section(section);
+	} catch (runtime_error &e) {
+		return true;
+	}
+	return false;
+}
+
+int main() {
+	const string header =
+		"Subject: outer\r\n"
+		"Content-Type: multipart/mixed; boundary=\"b\"\r\n"
+		"\r\n";
+	const string inner =
+		"Subject: inner\r\n"
+		"From: someone@example.org\r\n"
+		"Content-Type: multipart/alternative; boundary=\"c\"\r\n"
+		"\r\n"
+		"--c\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"plain\r\n"
+		"--c\r\n"
+		"Content-Type: text/html\r\n"
+		"\r\n"
+		"<p>html</p>\r\n"
+		"--c--\r\n";
+	const string body =
+		"--b\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"first\r\n"
+		"--b\r\n"
+		"Content-Type: message/rfc822\r\n"
+		"\r\n"
+		+ inner +
+		"--b--\r\n";
+
+	Mimesis::Message msg;
+	msg.from_string(header + body);
+
+	// The whole message, its header and its text
+	assert(msg.get_section("") == header + body);
+	assert(msg.get_section("HEADER") == header);
+	assert(msg.get_section("TEXT") == body);
+	assert(msg.get_section("header") == header);
+
+	// Parts and their MIME headers
+	assert(msg.get_section("1") == "first\r\n");
+	assert(msg.get_section("1.MIME") == "Content-Type: text/plain\r\n\r\n");
+	assert(msg.get_section("2") == inner);
+	assert(msg.get_section("2.MIME") == "Content-Type: message/rfc822\r\n\r\n");
+
+	// Sections of the embedded message
+	assert(msg.get_section("2.HEADER") == inner.substr(0, inner.find("\r\n\r\n") + 4));
+	assert(msg.get_section("2.TEXT") == inner.substr(inner.find("\r\n\r\n") + 4));
+	assert(msg.get_section("2.1") == "plain\r\n");
+	assert(msg.get_section("2.2") == "<p>html</p>\r\n");
+	assert(msg.get_section("2.2.MIME") == "Content-Type: text/html\r\n\r\n");
+	assert(msg.get_section("2.HEADER.FIELDS (SUBJECT \"From\")") == "Subject: inner\r\nFrom: someone@example.org\r\n\r\n");
+	assert(msg.get_section("2.HEADER.FIELDS.NOT (Subject Content-Type)") == "From: someone@example.org\r\n\r\n");
+
+	// Parts that do not exist
+	assert(msg.get_section("3") == "");
+	assert(msg.get_section("1.1") == "");
+	assert(msg.get_section("1.TEXT") == "");
+	assert(msg.get_section("2.3") == "");
+	assert(msg.get_section("2.1.1") == "");
+
+	// Invalid sections
+	assert(is_invalid(msg, "0"));
+	assert(is_invalid(msg, "1."));
+	assert(is_invalid(msg, "MIME"));
+	assert(is_invalid(msg, "1.BODY"));
+	assert(is_invalid(msg, "HEADER.FIELDS"));
+	assert(is_invalid(msg, "HEADER.FIELDS ()"));
+
+	// Partial ranges, across pieces and beyond the end
+	auto all = header + body;
+	for (size_t offset = 0; offset <= all.size() + 1; offset += 7)
+		for (size_t length: {size_t(0), size_t(1), size_t(10), size_t(100), SIZE_MAX})
+			assert(msg.get_section("", offset, length) == (offset < all.size() ? all.substr(offset, length) : ""));
+
+	assert(msg.get_section("2.TEXT", 5, 3) == body.substr(body.find("--c") + 5, 3));
+	assert(msg.get_section("HEADER.FIELDS (Subject)", 9, 100) == "outer\r\n\r\n");
+
+	// Selected fields are returned as they were read, like the whole header
+	{
+		const string folded =
+			"Subject:  folded\r\n"
+			"\tsubject\r\n"
+			"Cc:\r\n"
+			"X-Other: other\r\n"
+			"\r\n"
+			"body\r\n";
+		Mimesis::Message raw;
+		raw.from_string(folded);
+		assert(raw.get_section("HEADER.FIELDS (subject cc)") == "Subject:  folded\r\n\tsubject\r\nCc:\r\n\r\n");
+		assert(raw.get_section("HEADER.FIELDS.NOT (Subject)") == "Cc:\r\nX-Other: other\r\n\r\n");
+
+		raw.set_header("Subject", "changed");
+		assert(raw.get_section("HEADER.FIELDS (Subject X-Other)") == "Subject: changed\r\nX-Other: other\r\n\r\n");
+	}
+
+	// A single part message has its body as part 1
+	{
+		Mimesis::Message single;
+		single.from_string("Subject: single\n\nbody\n");
+		assert(single.get_section("1") == "body\n");
+		assert(single.get_section("TEXT") == "body\n");
+		assert(single.get_section("1.MIME") == "Subject: single\n\n");
+		assert(single.get_section("2") == "");
+		assert(single.get_section("HEADER", 9) == "single\n\n");
+	}
+
+	// Bodies stored in a file
+	{
+		Mimesis::Message attached;
+		attached.set_plain("text\r\n");
+		{
+			ofstream out("section.tmp", ios::binary);
+			out << "0123456789";
+		}
+		attached.attach_file("section.tmp", "application/octet-stream", "digits.bin");
+		unlink("section.tmp");
+		auto saved = attached.to_string();
+		auto encoded = attached.get_section("2");
+		assert(!encoded.empty());
+		assert(saved.find(encoded) != string::npos);
+		assert(attached.get_section("2", 2, 4) == encoded.substr(2, 4));
+	}
+}
@@ -0,0 +1,149 @@
+/* This tests saving messages for transmission over SMTP. */
+
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string save_data(const Mimesis::Part &part) {
+	ostringstream out;
+	part.save_data(out);
+	return out.str();
+}
+
+int main() {
+	// Line endings are converted and leading dots are doubled.
+	const string lf = "Subject: dots\n\n.\n..two\nmiddle . dot\n.last\n";
+	const string crlf = "Subject: dots\r\n\r\n.\r\n..two\r\nmiddle . dot\r\n.last\r\n";
+	const string stuffed = "Subject: dots\r\n\r\n..\r\n...two\r\nmiddle . dot\r\n..last\r\n.\r\n";
+
+	Mimesis::Message msg;
+	msg.from_string(lf);
+	assert(save_data(msg) == stuffed);
+
+	msg.clear();
+	msg.from_string(crlf);
+	assert(save_data(msg) == stuffed);
+
+	// Mixed line endings, and a body without a final newline
+	{
+		Mimesis::Message mixed;
+		mixed.set_header("Subject", "mixed");
+		mixed.set_body("a\nb\r\n\nc");
+		assert(save_data(mixed) == "Subject: mixed\r\n\r\na\r\nb\r\n\r\nc\r\n.\r\n");
+
+		mixed.set_body("a\r");
+		assert(save_data(mixed) == "Subject: mixed\r\n\r\na\r\n.\r\n");
+	}
+
+	// Chunks for BDAT are not dot-stuffed.
+	for (size_t size: {1, 3, 7, 64, 100000}) {
+		string result;
+		vector<size_t> sizes;
+		size_t last = 0;
+		msg.save_chunks(size, [&](const char *data, size_t len, bool is_last) {
+			result.append(data, len);
+			sizes.push_back(len);
+			last += is_last;
+		});
+
+		assert(result == crlf);
+		assert(last == 1);
+		for (size_t i = 0; i + 1 < sizes.size(); i++)
+			assert(sizes[i] == size);
+		assert(sizes.back() > 0 && sizes.back() <= size);
+	}
+
+	// Loading the content of a DATA command, followed by the next command
+	{
+		const string data = save_data(msg);
+		istringstream in(data + "QUIT\r\n");
+		Mimesis::ParseOptions options;
+		options.smtp_data = true;
+
+		Mimesis::Message received;
+		auto result = received.try_load(in, options);
+		assert(result);
+		assert(result.bytes_read == data.size());
+		assert(received == msg);
+		assert(received.to_string() == crlf);
+
+		string next;
+		getline(in, next);
+		assert(next == "QUIT\r");
+
+		// The terminator can end a multipart early.
+		Mimesis::Message multipart;
+		result = multipart.try_from_string("Content-Type: multipart/mixed; boundary=b\n\n--b\n\n..x\n.\n--b--\n", options);
+		assert(!result);
+		assert(result.error == Mimesis::ParseError::unterminated_multipart);
+		assert(result.bytes_read == 54);
+
+		// The terminator is required, unless recovering from errors.
+		result = received.try_from_string("Subject: a\r\n\n..b\r\n", options);
+		assert(!result);
+		assert(result.error == Mimesis::ParseError::unterminated_data);
+		assert(result.bytes_read == 18);
+
+		options.recover = true;
+		received.clear();
+		result = received.try_from_string("Subject: a\r\n\r\n..b\r\n", options);
+		assert(result);
+		assert(result.recovered == 1);
+		assert(received.get_body() == ".b\r\n");
+
+		// Without the option, dots are kept.
+		received.clear();
+		received.from_string(data);
+		assert(received.get_body().find("...two") != string::npos);
+	}
+
+	// Multiparts and bodies stored in files
+	{
+		{
+			ofstream out("smtp.tmp", ios::binary);
+			out << ".dot\nline\n";
+		}
+
+		Mimesis::Message multi;
+		multi.set_crlf(false);
+		multi.set_header("Subject", "files");
+		multi.set_plain("text\n");
+		multi.attach_file("smtp.tmp", "message/rfc822", "dot.eml");
+		multi.set_boundary("b");
+		unlink("smtp.tmp");
+
+		auto saved = multi.to_string();
+		assert(saved.find("\n.dot\nline\n") != string::npos);
+
+		string expected;
+		for (auto c: saved) {
+			if (c == '\n' && (expected.empty() || expected.back() != '\r'))
+				expected.push_back('\r');
+			expected.push_back(c);
+		}
+		expected.replace(expected.find("\r\n.dot"), 6, "\r\n..dot");
+		expected.append(".\r\n");
+		assert(save_data(multi) == expected);
+
+		// To a file descriptor
+		int fd = open("smtp.out", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		assert(fd != -1);
+		multi.save_data(fd);
+		close(fd);
+
+		ifstream in("smtp.out", ios::binary);
+		stringstream ss;
+		ss << in.rdbuf();
+		assert(ss.str() == expected);
+		unlink("smtp.out");
+	}
+}
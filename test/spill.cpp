@@ -0,0 +1,94 @@
+/* This tests storing large bodies in temporary files while parsing. */
+
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static string read_file(const string &filename) {
+	ifstream in(filename, ios::binary);
+	return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+int main() {
+	string data;
+	for (int i = 0; data.size() < 100000; i++)
+		data += "Line " + to_string(i) + "\r\n";
+
+	string text;
+	while (text.size() < 5000)
+		text += "The quick brown fox jumps over the lazy dog.\r\n";
+
+	Mimesis::Message orig;
+	orig.set_header("Subject", "Large attachment");
+	orig.set_plain(text);
+	orig.attach(data, "text/csv", "data.csv");
+	orig.attach("small\r\n", "text/plain", "small.txt");
+	auto str = orig.to_string();
+
+	Mimesis::Message in_memory;
+	in_memory.from_string(str);
+
+	for (string directory: {"", "."}) {
+		Mimesis::ParseOptions options;
+		options.spill_threshold = 1024;
+		options.spill_directory = directory;
+
+		Mimesis::Message msg;
+		assert(msg.try_from_string(str, options));
+
+		// Spilled bodies behave like bodies in memory
+		assert(msg == in_memory);
+		assert(msg.get_plain() == text);
+		auto attachments = msg.get_attachments();
+		assert(attachments.size() == 2);
+		assert(attachments[0]->get_body() == data);
+		assert(attachments[1]->get_body() == "small\r\n");
+
+		// And are saved unchanged
+		assert(msg.to_string() == str);
+		assert(msg.serialized_size() == str.size());
+
+		int fd = open("spill.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		assert(fd != -1);
+		msg.save(fd);
+		assert(close(fd) == 0);
+		assert(read_file("spill.tmp") == str);
+
+		// Modifying a spilled body replaces it
+		Mimesis::Message copy = msg;
+		copy.get_parts()[1].set_body("replaced\r\n");
+		assert(copy != msg);
+		assert(copy.get_attachments()[0]->get_body() == "replaced\r\n");
+	}
+
+	// The threshold also applies to a body that is cut off by an error
+	{
+		Mimesis::ParseOptions options;
+		options.spill_threshold = 1024;
+		auto truncated = str.substr(0, str.size() / 2);
+
+		Mimesis::Message msg;
+		assert(!msg.try_from_string(truncated, options));
+	}
+
+	// Failure to create a temporary file is reported
+	{
+		Mimesis::ParseOptions options;
+		options.spill_threshold = 1024;
+		options.spill_directory = "/nonexistent";
+
+		Mimesis::Message msg;
+		auto result = msg.try_from_string(str, options);
+		assert(result.error == Mimesis::ParseError::read_error);
+	}
+
+	unlink("spill.tmp");
+}
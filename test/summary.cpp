@@ -0,0 +1,71 @@
+/* This tests summarizing a message in one pass. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	Mimesis::Message msg;
+	msg.set_header("From", "=?utf-8?q?J=C3=B6rg?= <jorg@example.org>");
+	msg.set_header("To", "you@example.org");
+	msg.set_header("Subject", "=?iso-8859-1?b?SGVsbG8g5g==?=");
+	msg.set_header("Message-ID", "<1@example.org>");
+	msg.set_date(chrono::system_clock::from_time_t(1500000000));
+	msg.set_plain("plain\r\n");
+	msg.set_html("<img src=\"cid:logo@example.org\">\r\n");
+	auto &logo = msg.get_first_matching_part("text/html")->attach("PNG\r\n", "image/png");
+	logo.set_header("Content-Disposition", "inline");
+	logo.set_header("Content-ID", "<logo@example.org>");
+	msg.attach("attachment\r\n", "application/pdf", "report.pdf");
+
+	auto summary = msg.summarize();
+	assert(summary.plain && summary.plain == msg.get_first_matching_part("text/plain"));
+	assert(summary.html && summary.html == msg.get_first_matching_part("text/html"));
+	assert(summary.plain->get_body() == msg.get_plain());
+	assert(summary.html->get_body() == msg.get_html());
+
+	assert(summary.attachments.size() == 1);
+	assert(summary.attachments[0].part == msg.get_attachments()[0]);
+	assert(summary.attachments[0].filename == "report.pdf");
+	assert(summary.attachments[0].mime_type == "application/pdf");
+	assert(summary.attachments[0].size == 12);
+
+	assert(summary.content_ids.size() == 1);
+	assert(summary.content_ids[0].first == "logo@example.org");
+	assert(summary.content_ids[0].second->is_mime_type("image/png"));
+
+	size_t parts = 0;
+	for (auto &position: msg.walk())
+		(void)position, parts++;
+	assert(summary.parts == parts);
+	assert(summary.body_size == 7 + 34 + 5 + 12);
+
+	assert(summary.subject == "Hello \xc3\xa6");
+	assert(summary.from == "J\xc3\xb6rg <jorg@example.org>");
+	assert(summary.to == "you@example.org");
+	assert(summary.cc.empty());
+	assert(summary.message_id == "<1@example.org>");
+	assert(summary.date == msg.get_date());
+
+	// Underscores, adjacent encoded words, and headers that cannot be decoded
+	Mimesis::Message words;
+	words.set_header("Subject", "=?utf-8?q?a_b?= =?utf-8?q?c?=\r\n =?utf-8?q?_d?= e");
+	words.set_header("From", "=?x-bogus?q?abc?=");
+	words.set_header("To", "=?utf-8?q?caf=E9?=");
+	words.set_header("Cc", "=?utf-8?q?caf=C3=A9?=");
+	auto words_summary = words.summarize();
+	assert(words_summary.subject == "a bc d e");
+	assert(words_summary.from == "=?x-bogus?q?abc?=");
+	assert(words_summary.to == "=?utf-8?q?caf=E9?=");
+	assert(words_summary.cc == "caf\xc3\xa9");
+
+	// An empty message
+	Mimesis::Message empty;
+	auto empty_summary = empty.summarize();
+	assert(!empty_summary.plain && !empty_summary.html);
+	assert(empty_summary.attachments.empty());
+	assert(empty_summary.parts == 1);
+}
@@ -0,0 +1,93 @@
+/* This tests parsing and building messages from multiple threads at once.
+ * It should be run with ThreadSanitizer enabled to catch data races.
+ */
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+static const int nthreads = 8;
+static const int iterations = 200;
+
+struct result {
+	vector<string> boundaries;
+	vector<string> msgids;
+};
+
+static void worker(const vector<string> &inputs, const Mimesis::Message &shared, result &result) {
+	for (int i = 0; i < iterations; i++) {
+		// Parse and reproduce
+		for (auto &input: inputs) {
+			Mimesis::Message msg;
+			msg.from_string(input);
+			assert(msg.to_string() == input);
+		}
+
+		// Read-only access to a message shared between threads
+		assert(shared["Subject"] == "Test");
+		assert(shared["X-Missing"].empty());
+		assert(shared.get_plain() == "Hellö!\r\n");
+		assert(shared.get_date() == chrono::system_clock::time_point(chrono::seconds(1000000000)));
+
+		// Building
+		Mimesis::Message msg;
+		msg["From"] = "Some One <some.one@example.org>";
+		msg["Subject"] = "Test";
+		msg.set_date();
+		msg.generate_msgid("example.org");
+		msg.set_plain("Hello!\r\n");
+		msg.set_html("<p>Hello!</p>\r\n");
+		msg.attach("This is the attachment.\r\n", "text/plain", "attachment.txt");
+		assert(msg.get_date() != chrono::system_clock::time_point());
+		result.boundaries.push_back(msg.get_boundary());
+		result.boundaries.push_back(msg.get_parts()[0].get_boundary());
+		result.msgids.push_back(msg["Message-ID"]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	vector<string> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		ifstream in(argv[i]);
+		stringstream ss;
+		ss << in.rdbuf();
+		inputs.push_back(ss.str());
+	}
+
+	Mimesis::Message shared;
+	shared["Subject"] = "Test";
+	shared["Content-Type"] = "text/plain; charset=iso-8859-1";
+	shared.set_body("Hell\xf6!\r\n");
+	shared.set_date(chrono::system_clock::time_point(chrono::seconds(1000000000)));
+
+	vector<result> results(nthreads);
+	vector<thread> threads;
+
+	for (int i = 0; i < nthreads; i++)
+		threads.emplace_back(worker, cref(inputs), cref(shared), ref(results[i]));
+
+	for (auto &thread: threads)
+		thread.join();
+
+	// All generated boundaries and Message-IDs must be unique
+	set<string> boundaries;
+	set<string> msgids;
+
+	for (auto &result: results) {
+		boundaries.insert(begin(result.boundaries), end(result.boundaries));
+		msgids.insert(begin(result.msgids), end(result.msgids));
+	}
+
+	assert(boundaries.size() == 2 * nthreads * iterations);
+	assert(msgids.size() == nthreads * iterations);
+}
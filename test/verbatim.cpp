@@ -0,0 +1,104 @@
+/* This tests that unmodified header fields and delimiter lines are saved as they were read. */
+
+#include <cassert>
+#include <string>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	// Folded fields, empty fields, unusual spacing, padded delimiters and mixed line endings
+	const string header =
+		"Received: from a.example.org\r\n"
+		"\tby b.example.org; Thu, 01 Jan 1970 00:00:00 +0000\r\n"
+		"Subject:no space\r\n"
+		"To:   spaced@example.org  \r\n"
+		"Cc:\r\n"
+		"Bcc:\t\r\n"
+		"DKIM-Signature: v=1; a=rsa-sha256;\r\n"
+		" b=abcdef\r\n"
+		"  ghijkl\r\n"
+		"Content-Type: multipart/mixed;\r\n"
+		" boundary=\"b\"\r\n"
+		"\r\n";
+	const string body =
+		"preamble\r\n"
+		"--b  \r\n"
+		"Content-Type: text/plain;\n"
+		"  charset=us-ascii\n"
+		"\n"
+		"text\n"
+		"--b\t\r\n"
+		"Content-Type: text/html\r\n"
+		"\r\n"
+		"<p>html</p>\r\n"
+		"--b-- \r\n"
+		"epilogue\r\n";
+	const string data = header + body;
+
+	Mimesis::Message msg;
+	msg.from_string(data);
+	assert(msg.get_header("Subject") == "no space");
+	assert(msg.get_header("DKIM-Signature") == "v=1; a=rsa-sha256; b=abcdef  ghijkl");
+	assert(msg.to_string() == data);
+	assert(msg.serialized_size() == data.size());
+
+	// Adding a header leaves the rest as it was.
+	msg.add_received("c.example.org", chrono::system_clock::time_point());
+	auto received = "Received: " + msg.get_header("Received") + "\r\n";
+	assert(msg.to_string() == received + data);
+
+	// Only changed fields are written again.
+	msg.set_header("Subject", "changed");
+	auto expected = received + data;
+	expected.replace(expected.find("Subject:no space"), 16, "Subject: changed");
+	assert(msg.to_string() == expected);
+
+	msg.erase_header("To");
+	expected.erase(expected.find("To:"), 28);
+	assert(msg.to_string() == expected);
+
+	// Changes through references are noticed as well.
+	msg.get_headers()[0].second = "new";
+	expected.replace(0, received.size(), "Received: new\r\n");
+	assert(msg.to_string() == expected);
+
+	// Changing the boundary replaces the delimiter lines.
+	msg.set_boundary("c");
+	auto saved = msg.to_string();
+	assert(saved.find("--b") == string::npos);
+	assert(saved.find("\r\n--c\r\nContent-Type: text/plain;\n  charset=us-ascii\n\ntext\n--c\r\n") != string::npos);
+	assert(saved.find("\r\n--c--\r\nepilogue\r\n") != string::npos);
+
+	Mimesis::Message reloaded;
+	reloaded.from_string(saved);
+	assert(reloaded == msg);
+	assert(reloaded.to_string() == saved);
+
+	// Added parts get new delimiter lines, existing parts keep theirs.
+	{
+		Mimesis::Message msg2;
+		msg2.from_string(data);
+		msg2.append_part().set_body("added\r\n");
+		auto result = msg2.to_string();
+		auto close = body.find("--b-- \r\n");
+		assert(result.substr(0, header.size() + close) == data.substr(0, header.size() + close));
+		assert(result.substr(header.size() + close) == "--b\r\n\r\nadded\r\n--b-- \r\nepilogue\r\n");
+	}
+
+	// Changing line endings writes everything again.
+	{
+		Mimesis::Message msg2;
+		msg2.from_string("Subject: a\r\n b\r\n\r\nbody\r\n");
+		msg2.set_crlf(false);
+		assert(msg2.to_string() == "Subject: a b\n\nbody\r\n");
+	}
+
+	// Headers that were not terminated by an empty line
+	{
+		Mimesis::Message msg2;
+		msg2.from_string("Subject: a\r\nTo: b\r\n  c");
+		assert(msg2.to_string() == "Subject: a\r\nTo: b  c\r\n\r\n");
+	}
+}
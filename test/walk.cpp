@@ -0,0 +1,112 @@
+/* This tests walking over all parts of a message. */
+
+#include <cassert>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <mimesis.hpp>
+
+using namespace std;
+
+int main() {
+	Mimesis::Message msg;
+	msg.set_header("From", "me");
+	msg.set_plain("plain\r\n");
+	msg.set_html("html\r\n");
+	msg.attach("attachment\r\n", "text/plain", "foo.txt");
+
+	// multipart/mixed
+	//   multipart/alternative
+	//     text/plain
+	//     text/html
+	//   text/plain attachment
+	vector<string> types;
+	vector<size_t> depths;
+	vector<string> sections;
+	for (auto &position: msg.walk()) {
+		types.push_back(position.get_part().get_mime_type());
+		depths.push_back(position.get_depth());
+		sections.push_back(position.get_section());
+	}
+
+	assert((types == vector<string>{"multipart/mixed", "multipart/alternative", "text/plain", "text/html", "text/plain"}));
+	assert((depths == vector<size_t>{0, 1, 2, 2, 1}));
+	assert((sections == vector<string>{"", "1", "1.1", "1.2", "2"}));
+
+	// Parts can be modified during a walk
+	for (auto &position: msg.walk())
+		position.get_part().set_header("X-Section", position.get_section());
+	assert(msg.get_parts()[0].get_parts()[1].get_header("X-Section") == "1.2");
+
+	// Walking a const part
+	const Mimesis::Part &cmsg = msg;
+	size_t count = 0;
+	for (auto it = cmsg.walk().begin(); it != cmsg.walk().end(); ++it)
+		count++;
+	assert(count == 5);
+
+	// Visiting with early exit
+	count = 0;
+	bool complete = cmsg.visit([&](const Mimesis::Part &part, size_t depth) {
+		count++;
+		return !(depth == 2 && part.is_mime_type("text/html"));
+	});
+	assert(!complete);
+	assert(count == 4);
+
+	assert(msg.visit([](Mimesis::Part &, size_t) { return true; }));
+
+	// Finding parts with an inlined predicate
+	{
+		size_t calls = 0;
+		auto html = cmsg.get_first_matching_part([&](const Mimesis::Part &part) {
+			calls++;
+			return part.is_mime_type("text/html");
+		});
+		assert(html && html->get_body() == "html\r\n");
+		assert(calls == 4);
+
+		// Attachments are skipped
+		assert(!cmsg.get_first_matching_part([](const Mimesis::Part &part) {
+			return part.is_attachment();
+		}));
+
+		Mimesis::Part *plain = msg.get_first_matching_part([](const Mimesis::Part &part) {
+			return part.is_mime_type("text/plain");
+		});
+		assert(plain == &msg.get_parts()[0].get_parts()[0]);
+
+		// The type-erased overload gives the same result
+		function<bool(const Mimesis::Part &)> predicate = [](const Mimesis::Part &part) {
+			return part.is_mime_type("text/html");
+		};
+		assert(cmsg.get_first_matching_part(predicate) == html);
+		assert(cmsg.get_first_matching_part("text/html") == html);
+	}
+
+	// Deeply nested parts
+	Mimesis::Part root;
+	Mimesis::Part *part = &root;
+	for (int i = 0; i < 40; i++) {
+		part->make_multipart("mixed");
+		part->append_part();
+		part = &part->append_part();
+	}
+	part->set_body("leaf\r\n");
+
+	size_t max_depth = 0;
+	string deepest;
+	count = 0;
+	for (auto &position: root.walk()) {
+		count++;
+		if (position.get_depth() > max_depth) {
+			max_depth = position.get_depth();
+			deepest = position.get_section();
+		}
+	}
+	assert(count == 81);
+	assert(max_depth == 40);
+	assert(deepest.size() == 40 * 2 - 1);
+	assert(deepest.substr(0, 4) == "2.2.");
+}